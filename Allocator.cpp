@@ -0,0 +1,740 @@
+#include "Allocator.h"
+
+#include "llvm/IR/Module.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#endif
+
+namespace clang {
+
+namespace {
+
+// every block handed out starts with a header, so free and realloc find the
+// size class without a lookup.
+struct BlockHeader {
+  uint32_t Class;  // size class index or one of the block kinds below
+  uint32_t Offset; // AlignedBlock: distance back to the underlying block
+  uint64_t Size;   // usable bytes after the header
+};
+
+constexpr size_t HeaderSize = sizeof(BlockHeader);
+static_assert(HeaderSize == 16, "payloads must stay 16 byte aligned");
+
+enum : uint32_t {
+  LargeBlock = 0xffffffff,
+  AlignedBlock = 0xfffffffe,
+  ArenaBlock = 0xfffffffd,
+};
+
+// sizes up to 128 bytes go in steps of 16, larger ones in four steps per
+// power of two, up to MaxSmallSize.
+constexpr size_t MaxSmallSize = 32 * 1024;
+constexpr unsigned NumClasses = 40;
+
+constexpr size_t SpanSize = 256 * 1024;
+constexpr size_t ArenaChunkSize = 4 * 1024 * 1024;
+
+// upper bound of the reservation. larger requests or alignments go to libc,
+// which keeps the header and padding arithmetic below from wrapping around.
+constexpr size_t MaxReservation = size_t(64) << 30;
+
+unsigned getSizeClass(size_t Size) {
+  if (Size <= 128)
+    return Size == 0 ? 0 : (Size + 15) / 16 - 1;
+  size_t S = Size - 1;
+  unsigned K = llvm::Log2_64(S);
+  return 8 + (K - 7) * 4 + ((S >> (K - 2)) & 3);
+}
+
+constexpr size_t computeClassSize(unsigned C) {
+  if (C < 8)
+    return 16 * (C + 1);
+  unsigned K = 7 + (C - 8) / 4;
+  return (size_t(1) << K) + ((C - 8) % 4 + 1) * (size_t(1) << (K - 2));
+}
+
+// number of blocks moved between a thread cache and the central list at once
+constexpr size_t computeBatchSize(unsigned C) {
+  size_t N = 32 * 1024 / computeClassSize(C);
+  return N < 4 ? 4 : (N > 128 ? 128 : N);
+}
+
+struct ClassTable {
+  size_t Size[NumClasses];
+  size_t Batch[NumClasses];
+
+  constexpr ClassTable() : Size(), Batch() {
+    for (unsigned C = 0; C < NumClasses; C++) {
+      Size[C] = computeClassSize(C);
+      Batch[C] = computeBatchSize(C);
+    }
+  }
+};
+
+constexpr ClassTable Classes;
+
+size_t getClassSize(unsigned C) { return Classes.Size[C]; }
+size_t getBatchSize(unsigned C) { return Classes.Batch[C]; }
+
+// one large reservation that all blocks are carved from. pages are only
+// committed when touched, and a pointer belongs to the allocator iff it lies
+// inside the reservation.
+class Region {
+  char *Base = nullptr;
+  size_t Size = 0;
+  std::atomic<size_t> Top{0};
+
+public:
+  void reserve() {
+    for (size_t S = MaxReservation; S >= (size_t(1) << 30); S >>= 1) {
+      void *P = mmap(nullptr, S, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (P != MAP_FAILED) {
+        Base = static_cast<char *>(P);
+        Size = S;
+        return;
+      }
+    }
+  }
+
+  // Bytes must be a multiple of the page size. returns nullptr when the
+  // reservation is exhausted.
+  char *allocate(size_t Bytes) {
+    size_t Old = Top.fetch_add(Bytes, std::memory_order_relaxed);
+    if (Old + Bytes > Size)
+      return nullptr;
+    return Base + Old;
+  }
+
+  bool owns(const void *P) const {
+    const char *C = static_cast<const char *>(P);
+    return C >= Base && C < Base + Size;
+  }
+
+  size_t used() const {
+    size_t T = Top.load(std::memory_order_relaxed);
+    return T > Size ? Size : T;
+  }
+};
+
+struct FreeBlock {
+  FreeBlock *Next;
+};
+
+struct CentralList {
+  std::mutex Lock;
+  FreeBlock *Head = nullptr;
+};
+
+struct AllocStats {
+  std::atomic<uint64_t> Allocs{0};
+  std::atomic<uint64_t> Frees{0};
+  std::atomic<uint64_t> Reallocs{0};
+  std::atomic<uint64_t> ForeignFrees{0};
+  std::atomic<uint64_t> Fallbacks{0};
+  std::atomic<uint64_t> BytesAllocated{0};
+  std::atomic<uint64_t> LiveBytes{0};
+  std::atomic<uint64_t> PeakBytes{0};
+};
+
+struct AllocatorState {
+  AllocatorKind Kind;
+  bool CollectStats;
+  size_t PageSize;
+  Region Heap;
+  CentralList Central[NumClasses];
+
+  // freed large blocks keyed by their size in bytes, header included
+  std::mutex LargeLock;
+  std::multimap<size_t, char *> LargeFree;
+
+  AllocStats Stats;
+};
+
+// never destroyed: jit'd static destructors may still free memory while the
+// host process is exiting.
+AllocatorState *State = nullptr;
+
+struct ThreadCache {
+  FreeBlock *Head[NumClasses];
+  uint32_t Count[NumClasses];
+};
+
+struct ArenaCursor {
+  char *Cur;
+  char *End;
+};
+
+// trivially destructible, so access needs no guard. blocks cached by a thread
+// that exits are not returned; scripts are short-lived.
+thread_local ThreadCache TCache;
+thread_local ArenaCursor TArena;
+
+BlockHeader *getHeader(void *P) {
+  return reinterpret_cast<BlockHeader *>(static_cast<char *>(P) - HeaderSize);
+}
+
+void recordAlloc(size_t Bytes) {
+  if (!State->CollectStats)
+    return;
+  AllocStats &S = State->Stats;
+  S.Allocs.fetch_add(1, std::memory_order_relaxed);
+  S.BytesAllocated.fetch_add(Bytes, std::memory_order_relaxed);
+  uint64_t Live = S.LiveBytes.fetch_add(Bytes, std::memory_order_relaxed) +
+                  Bytes;
+  uint64_t Peak = S.PeakBytes.load(std::memory_order_relaxed);
+  while (Live > Peak &&
+         !S.PeakBytes.compare_exchange_weak(Peak, Live,
+                                            std::memory_order_relaxed))
+    ;
+}
+
+void recordFree(size_t Bytes) {
+  if (!State->CollectStats)
+    return;
+  State->Stats.Frees.fetch_add(1, std::memory_order_relaxed);
+  State->Stats.LiveBytes.fetch_sub(Bytes, std::memory_order_relaxed);
+}
+
+void recordEvent(std::atomic<uint64_t> &Counter) {
+  if (State->CollectStats)
+    Counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+void *fallbackMalloc(size_t Size) {
+  recordEvent(State->Stats.Fallbacks);
+  return ::malloc(Size);
+}
+
+void *fallbackAlignedAlloc(size_t Align, size_t Size) {
+  recordEvent(State->Stats.Fallbacks);
+  void *P = nullptr;
+  if (int Err = posix_memalign(&P, Align, Size)) {
+    errno = Err;
+    return nullptr;
+  }
+  return P;
+}
+
+size_t foreignUsableSize(void *P) {
+#if defined(__GLIBC__)
+  return ::malloc_usable_size(P);
+#elif defined(__APPLE__)
+  return ::malloc_size(P);
+#else
+  return 0;
+#endif
+}
+
+void *largeMalloc(size_t Size) {
+  size_t Total = llvm::alignTo(Size + HeaderSize, State->PageSize);
+  char *B = nullptr;
+  {
+    std::lock_guard<std::mutex> Guard(State->LargeLock);
+    auto It = State->LargeFree.lower_bound(Total);
+    if (It != State->LargeFree.end() && It->first <= 2 * Total) {
+      Total = It->first;
+      B = It->second;
+      State->LargeFree.erase(It);
+    }
+  }
+
+  if (!B)
+    B = State->Heap.allocate(Total);
+  if (!B)
+    return fallbackMalloc(Size);
+
+  BlockHeader *H = reinterpret_cast<BlockHeader *>(B);
+  H->Class = LargeBlock;
+  H->Offset = 0;
+  H->Size = Total - HeaderSize;
+  recordAlloc(Total);
+  return B + HeaderSize;
+}
+
+void largeFree(BlockHeader *H) {
+  size_t Total = H->Size + HeaderSize;
+  recordFree(Total);
+
+  // hand the pages back to the os but keep the one holding the header
+  char *B = reinterpret_cast<char *>(H);
+  if (Total > State->PageSize)
+    madvise(B + State->PageSize, Total - State->PageSize, MADV_DONTNEED);
+
+  std::lock_guard<std::mutex> Guard(State->LargeLock);
+  State->LargeFree.emplace(Total, B);
+}
+
+// moves a batch of class C blocks from the central list into the calling
+// thread's cache, carving a fresh span when the central list is empty.
+bool refill(unsigned C) {
+  CentralList &CL = State->Central[C];
+  size_t Batch = getBatchSize(C);
+
+  std::lock_guard<std::mutex> Guard(CL.Lock);
+  if (!CL.Head) {
+    char *Span = State->Heap.allocate(SpanSize);
+    if (!Span)
+      return false;
+
+    size_t ClassSize = getClassSize(C);
+    size_t BlockSize = ClassSize + HeaderSize;
+    for (size_t i = SpanSize / BlockSize; i-- > 0;) {
+      char *B = Span + i * BlockSize;
+      BlockHeader *H = reinterpret_cast<BlockHeader *>(B);
+      H->Class = C;
+      H->Offset = 0;
+      H->Size = ClassSize;
+      FreeBlock *F = reinterpret_cast<FreeBlock *>(B + HeaderSize);
+      F->Next = CL.Head;
+      CL.Head = F;
+    }
+  }
+
+  FreeBlock *Head = CL.Head;
+  FreeBlock *Tail = Head;
+  uint32_t N = 1;
+  while (N < Batch && Tail->Next) {
+    Tail = Tail->Next;
+    N++;
+  }
+  CL.Head = Tail->Next;
+  Tail->Next = nullptr;
+
+  TCache.Head[C] = Head;
+  TCache.Count[C] = N;
+  return true;
+}
+
+// returns the oldest batch of the thread cache to the central list.
+void flush(unsigned C) {
+  size_t Batch = getBatchSize(C);
+  FreeBlock *Head = TCache.Head[C];
+  FreeBlock *Tail = Head;
+  for (size_t i = 1; i < Batch; i++)
+    Tail = Tail->Next;
+  TCache.Head[C] = Tail->Next;
+  TCache.Count[C] -= Batch;
+
+  CentralList &CL = State->Central[C];
+  std::lock_guard<std::mutex> Guard(CL.Lock);
+  Tail->Next = CL.Head;
+  CL.Head = Head;
+}
+
+void *poolMalloc(size_t Size) {
+  if (Size > MaxSmallSize)
+    return largeMalloc(Size);
+
+  unsigned C = getSizeClass(Size);
+  FreeBlock *F = TCache.Head[C];
+  if (!F) {
+    if (!refill(C))
+      return fallbackMalloc(Size);
+    F = TCache.Head[C];
+  }
+  TCache.Head[C] = F->Next;
+  TCache.Count[C]--;
+  recordAlloc(getClassSize(C));
+  return F;
+}
+
+void poolFree(void *P, unsigned C) {
+  recordFree(getClassSize(C));
+  FreeBlock *F = static_cast<FreeBlock *>(P);
+  F->Next = TCache.Head[C];
+  TCache.Head[C] = F;
+  if (++TCache.Count[C] > 2 * getBatchSize(C))
+    flush(C);
+}
+
+void *arenaMalloc(size_t Size) {
+  size_t Total = llvm::alignTo(Size + HeaderSize, HeaderSize);
+  if (Total > ArenaChunkSize / 4)
+    return largeMalloc(Size);
+
+  if (static_cast<size_t>(TArena.End - TArena.Cur) < Total) {
+    char *Chunk = State->Heap.allocate(ArenaChunkSize);
+    if (!Chunk)
+      return fallbackMalloc(Size);
+    TArena.Cur = Chunk;
+    TArena.End = Chunk + ArenaChunkSize;
+  }
+
+  BlockHeader *H = reinterpret_cast<BlockHeader *>(TArena.Cur);
+  TArena.Cur += Total;
+  H->Class = ArenaBlock;
+  H->Offset = 0;
+  H->Size = Total - HeaderSize;
+  recordAlloc(Total);
+  return H + 1;
+}
+
+void *ccintMalloc(size_t Size) {
+  if (Size > MaxReservation)
+    return fallbackMalloc(Size);
+  if (State->Kind == AllocatorKind::Arena)
+    return arenaMalloc(Size);
+  return poolMalloc(Size);
+}
+
+// releases a block owned by the allocator.
+void release(void *P) {
+  BlockHeader *H = getHeader(P);
+  if (H->Class == AlignedBlock) {
+    P = static_cast<char *>(P) - H->Offset;
+    H = getHeader(P);
+  }
+
+  switch (H->Class) {
+  case LargeBlock:
+    largeFree(H);
+    break;
+  case ArenaBlock:
+    // arena memory is only reclaimed in bulk when the process exits
+    recordFree(H->Size + HeaderSize);
+    break;
+  default:
+    poolFree(P, H->Class);
+    break;
+  }
+}
+
+void ccintFree(void *P) {
+  if (!P)
+    return;
+  if (!State->Heap.owns(P)) {
+    recordEvent(State->Stats.ForeignFrees);
+    ::free(P);
+    return;
+  }
+  release(P);
+}
+
+size_t ccintUsableSize(void *P) {
+  if (!P)
+    return 0;
+  if (!State->Heap.owns(P))
+    return foreignUsableSize(P);
+  return getHeader(P)->Size;
+}
+
+void *ccintCalloc(size_t N, size_t Size) {
+  if (Size && N > SIZE_MAX / Size) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  void *P = ccintMalloc(N * Size);
+  if (P)
+    memset(P, 0, N * Size);
+  return P;
+}
+
+void *ccintRealloc(void *P, size_t Size) {
+  if (!P)
+    return ccintMalloc(Size);
+  if (Size == 0) {
+    ccintFree(P);
+    return nullptr;
+  }
+  if (!State->Heap.owns(P))
+    return ::realloc(P, Size);
+
+  recordEvent(State->Stats.Reallocs);
+  size_t Usable = getHeader(P)->Size;
+  if (Size <= Usable)
+    return P;
+
+  void *Q = ccintMalloc(Size);
+  if (!Q)
+    return nullptr;
+  memcpy(Q, P, Usable);
+  release(P);
+  return Q;
+}
+
+void *ccintAlignedAlloc(size_t Align, size_t Size) {
+  if (Align <= HeaderSize)
+    return ccintMalloc(Size);
+  if (Size > MaxReservation || Align > MaxReservation)
+    return fallbackAlignedAlloc(Align, Size);
+
+  char *Raw = static_cast<char *>(ccintMalloc(Size + Align));
+  if (!Raw)
+    return nullptr;
+  if (!State->Heap.owns(Raw)) {
+    // the reservation is exhausted, let libc align it
+    ::free(Raw);
+    void *P = nullptr;
+    if (int Err = posix_memalign(&P, Align, Size)) {
+      errno = Err;
+      return nullptr;
+    }
+    return P;
+  }
+
+  // Raw is 16 byte aligned, so the aligned payload is at most Align bytes in
+  // and always leaves room for its own header inside the raw block
+  char *Aligned = reinterpret_cast<char *>(
+      llvm::alignTo(reinterpret_cast<uintptr_t>(Raw) + HeaderSize, Align));
+  BlockHeader *H = getHeader(Aligned);
+  H->Class = AlignedBlock;
+  H->Offset = static_cast<uint32_t>(Aligned - Raw);
+  H->Size = getHeader(Raw)->Size - H->Offset;
+  return Aligned;
+}
+
+int ccintPosixMemalign(void **Out, size_t Align, size_t Size) {
+  if (Align < sizeof(void *) || !llvm::isPowerOf2_64(Align))
+    return EINVAL;
+  void *P = ccintAlignedAlloc(Align, Size);
+  if (!P)
+    return ENOMEM;
+  *Out = P;
+  return 0;
+}
+
+void *ccintMemalign(size_t Align, size_t Size) {
+  return ccintAlignedAlloc(Align, Size);
+}
+
+void *ccintReallocArray(void *P, size_t N, size_t Size) {
+  if (Size && N > SIZE_MAX / Size) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  return ccintRealloc(P, N * Size);
+}
+
+void *ccintValloc(size_t Size) {
+  return ccintAlignedAlloc(State->PageSize, Size);
+}
+
+void *ccintPvalloc(size_t Size) {
+  if (Size > SIZE_MAX - State->PageSize) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  return ccintAlignedAlloc(State->PageSize,
+                           llvm::alignTo(Size ? Size : 1, State->PageSize));
+}
+
+// operator new falls back to the host implementation on failure, which
+// takes care of the new_handler and of throwing std::bad_alloc. memory it
+// returns is foreign and is released through the host operator delete.
+void *ccintNew(size_t Size) {
+  if (void *P = ccintMalloc(Size ? Size : 1))
+    return P;
+  return ::operator new(Size);
+}
+
+void *ccintNewNothrow(size_t Size, const std::nothrow_t &) noexcept {
+  return ccintMalloc(Size ? Size : 1);
+}
+
+// the aligned overloads only exist from c++17 on. a host built with an
+// older standard leaves both their allocation and deallocation side to the
+// c++ runtime, so they still pair up.
+#if __cpp_aligned_new
+void *ccintNewAligned(size_t Size, std::align_val_t Align) {
+  if (void *P = ccintAlignedAlloc(static_cast<size_t>(Align), Size ? Size : 1))
+    return P;
+  return ::operator new(Size, Align);
+}
+
+void *ccintNewAlignedNothrow(size_t Size, std::align_val_t Align,
+                             const std::nothrow_t &) noexcept {
+  return ccintAlignedAlloc(static_cast<size_t>(Align), Size ? Size : 1);
+}
+#endif
+
+void ccintDelete(void *P) noexcept {
+  if (!P)
+    return;
+  if (!State->Heap.owns(P)) {
+    recordEvent(State->Stats.ForeignFrees);
+    ::operator delete(P);
+    return;
+  }
+  release(P);
+}
+
+void ccintDeleteSized(void *P, size_t) noexcept { ccintDelete(P); }
+
+void ccintDeleteNothrow(void *P, const std::nothrow_t &) noexcept {
+  ccintDelete(P);
+}
+
+#if __cpp_aligned_new
+void ccintDeleteAligned(void *P, std::align_val_t Align) noexcept {
+  if (!P)
+    return;
+  if (!State->Heap.owns(P)) {
+    recordEvent(State->Stats.ForeignFrees);
+    ::operator delete(P, Align);
+    return;
+  }
+  release(P);
+}
+
+void ccintDeleteSizedAligned(void *P, size_t, std::align_val_t Align) noexcept {
+  ccintDeleteAligned(P, Align);
+}
+#endif
+
+const char *getKindName(AllocatorKind Kind) {
+  switch (Kind) {
+  case AllocatorKind::System:
+    return "system";
+  case AllocatorKind::Pool:
+    return "pool";
+  case AllocatorKind::Arena:
+    return "arena";
+  }
+  return "unknown";
+}
+
+} // anonymous namespace
+
+void installAllocator(AllocatorKind Kind, bool CollectStats) {
+  if (State || Kind == AllocatorKind::System)
+    return;
+
+  State = new AllocatorState();
+  State->Kind = Kind;
+  State->CollectStats = CollectStats;
+  State->PageSize = sysconf(_SC_PAGESIZE);
+  State->Heap.reserve();
+}
+
+void getAllocatorSymbols(llvm::StringMap<void *> &Symbols) {
+  if (!State)
+    return;
+
+  // itanium manglings, size_t is unsigned long on every supported host
+  static_assert(sizeof(size_t) == sizeof(unsigned long), "");
+
+  Symbols["malloc"] = reinterpret_cast<void *>(&ccintMalloc);
+  Symbols["calloc"] = reinterpret_cast<void *>(&ccintCalloc);
+  Symbols["realloc"] = reinterpret_cast<void *>(&ccintRealloc);
+  Symbols["free"] = reinterpret_cast<void *>(&ccintFree);
+  Symbols["posix_memalign"] = reinterpret_cast<void *>(&ccintPosixMemalign);
+  Symbols["aligned_alloc"] = reinterpret_cast<void *>(&ccintAlignedAlloc);
+  Symbols["memalign"] = reinterpret_cast<void *>(&ccintMemalign);
+  Symbols["reallocarray"] = reinterpret_cast<void *>(&ccintReallocArray);
+  Symbols["valloc"] = reinterpret_cast<void *>(&ccintValloc);
+  Symbols["pvalloc"] = reinterpret_cast<void *>(&ccintPvalloc);
+  Symbols["malloc_usable_size"] = reinterpret_cast<void *>(&ccintUsableSize);
+
+  Symbols["_Znwm"] = reinterpret_cast<void *>(&ccintNew);
+  Symbols["_Znam"] = reinterpret_cast<void *>(&ccintNew);
+  Symbols["_ZnwmRKSt9nothrow_t"] = reinterpret_cast<void *>(&ccintNewNothrow);
+  Symbols["_ZnamRKSt9nothrow_t"] = reinterpret_cast<void *>(&ccintNewNothrow);
+
+  Symbols["_ZdlPv"] = reinterpret_cast<void *>(&ccintDelete);
+  Symbols["_ZdaPv"] = reinterpret_cast<void *>(&ccintDelete);
+  Symbols["_ZdlPvm"] = reinterpret_cast<void *>(&ccintDeleteSized);
+  Symbols["_ZdaPvm"] = reinterpret_cast<void *>(&ccintDeleteSized);
+  Symbols["_ZdlPvRKSt9nothrow_t"] =
+      reinterpret_cast<void *>(&ccintDeleteNothrow);
+  Symbols["_ZdaPvRKSt9nothrow_t"] =
+      reinterpret_cast<void *>(&ccintDeleteNothrow);
+
+#if __cpp_aligned_new
+  using AlignedDelete = void (*)(void *, std::align_val_t) noexcept;
+  using SizedAlignedDelete =
+      void (*)(void *, size_t, std::align_val_t) noexcept;
+
+  Symbols["_ZnwmSt11align_val_t"] = reinterpret_cast<void *>(&ccintNewAligned);
+  Symbols["_ZnamSt11align_val_t"] = reinterpret_cast<void *>(&ccintNewAligned);
+  Symbols["_ZnwmSt11align_val_tRKSt9nothrow_t"] =
+      reinterpret_cast<void *>(&ccintNewAlignedNothrow);
+  Symbols["_ZnamSt11align_val_tRKSt9nothrow_t"] =
+      reinterpret_cast<void *>(&ccintNewAlignedNothrow);
+  Symbols["_ZdlPvSt11align_val_t"] =
+      reinterpret_cast<void *>(static_cast<AlignedDelete>(&ccintDeleteAligned));
+  Symbols["_ZdaPvSt11align_val_t"] =
+      reinterpret_cast<void *>(static_cast<AlignedDelete>(&ccintDeleteAligned));
+  Symbols["_ZdlPvmSt11align_val_t"] = reinterpret_cast<void *>(
+      static_cast<SizedAlignedDelete>(&ccintDeleteSizedAligned));
+  Symbols["_ZdaPvmSt11align_val_t"] = reinterpret_cast<void *>(
+      static_cast<SizedAlignedDelete>(&ccintDeleteSizedAligned));
+#endif
+}
+
+void getSystemAllocatorSymbols(llvm::StringMap<void *> &Symbols) {
+  llvm::StringMap<void *> Replaced;
+  getAllocatorSymbols(Replaced);
+  for (auto &KV : Replaced) {
+    if (void *Addr = llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(
+            KV.getKey().str()))
+      Symbols[KV.getKey()] = Addr;
+  }
+}
+
+llvm::StringRef findOwnershipTransfer(const llvm::Module &M) {
+  for (const llvm::Function &F : M) {
+    if (!F.isDeclaration() || F.isIntrinsic())
+      continue;
+
+    // they grow the buffer they are given with libc realloc
+    llvm::StringRef Name = F.getName();
+    if (Name == "getline" || Name == "getdelim" || Name == "__getdelim")
+      return Name;
+
+    // the host instantiates the strings and streams itself, and its code
+    // releases their buffers with its own operator delete. std::allocator
+    // mangles as SaI, the old std::string as Ss.
+    if (Name.startswith("_Z") &&
+        (Name.contains("SaI") || Name.startswith("_ZNSs") ||
+         Name.startswith("_ZNKSs")))
+      return Name;
+  }
+  return "";
+}
+
+void printAllocatorStats(llvm::raw_ostream &OS) {
+  if (!State) {
+    OS << "allocator: system (no statistics collected)\n";
+    return;
+  }
+
+  OS << "allocator: " << getKindName(State->Kind) << "\n";
+  if (!State->CollectStats)
+    return;
+
+  const AllocStats &S = State->Stats;
+  auto Print = [&](const char *Name, uint64_t Value) {
+    OS << llvm::format("  %-18s %16llu\n", Name,
+                       static_cast<unsigned long long>(Value));
+  };
+  Print("allocations:", S.Allocs.load());
+  Print("frees:", S.Frees.load());
+  Print("reallocations:", S.Reallocs.load());
+  Print("foreign frees:", S.ForeignFrees.load());
+  Print("libc fallbacks:", S.Fallbacks.load());
+  Print("bytes allocated:", S.BytesAllocated.load());
+  Print("peak live bytes:", S.PeakBytes.load());
+  Print("heap used:", State->Heap.used());
+}
+
+} // namespace clang
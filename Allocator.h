@@ -0,0 +1,46 @@
+#ifndef LLVM_CLANG_TOOLS_CLANG_CCINT_ALLOCATOR_H
+#define LLVM_CLANG_TOOLS_CLANG_CCINT_ALLOCATOR_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+namespace llvm {
+class Module;
+class raw_ostream;
+} // namespace llvm
+
+namespace clang {
+
+enum class AllocatorKind {
+  System, // host libc malloc, the default
+  Pool,   // thread-caching size-class pools
+  Arena,  // per-thread bump allocation, free is a no-op
+};
+
+// selects the allocator that getAllocatorSymbols hands out. must be called
+// before any jit'd code runs.
+void installAllocator(AllocatorKind Kind, bool CollectStats);
+
+// fills Symbols with the unmangled malloc/free/operator new/delete names and
+// the addresses of the built-in replacements. empty for AllocatorKind::System.
+//
+// only jit'd code is redirected. pointers the built-in allocator does not
+// own are forwarded to libc, which covers jit'd code freeing or growing
+// memory handed out by a library. the opposite direction is not covered,
+// see findOwnershipTransfer.
+void getAllocatorSymbols(llvm::StringMap<void *> &Symbols);
+
+// the same names, bound to the host's own malloc and operator new family.
+void getSystemAllocatorSymbols(llvm::StringMap<void *> &Symbols);
+
+// the first function M leaves to the host that may free or grow memory the
+// script allocated: getline and getdelim, and out-of-line code of the
+// standard strings and containers. memory of a module that calls one must
+// come from libc. empty if there is none.
+llvm::StringRef findOwnershipTransfer(const llvm::Module &M);
+
+void printAllocatorStats(llvm::raw_ostream &OS);
+
+} // namespace clang
+
+#endif // LLVM_CLANG_TOOLS_CLANG_CCINT_ALLOCATOR_H
@@ -0,0 +1,224 @@
+#include "Benchmark.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Errc.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <sys/resource.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace clang {
+
+namespace {
+
+struct CounterDesc {
+  const char *Name;
+  uint32_t Type;
+  uint64_t Config;
+};
+
+#ifdef __linux__
+const CounterDesc Counters[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+#endif
+
+// a group of user-space hardware counters for the calling thread. counters
+// the kernel refuses to open are skipped, so the group may be empty.
+class PerfCounters {
+  std::vector<int> FDs;
+  std::vector<const char *> Names;
+
+public:
+  PerfCounters() {
+#ifdef __linux__
+    int Leader = -1;
+    for (const CounterDesc &C : Counters) {
+      perf_event_attr Attr = {};
+      Attr.size = sizeof(Attr);
+      Attr.type = C.Type;
+      Attr.config = C.Config;
+      Attr.disabled = Leader == -1;
+      Attr.exclude_kernel = 1;
+      Attr.exclude_hv = 1;
+      Attr.read_format = PERF_FORMAT_GROUP;
+
+      int FD = syscall(SYS_perf_event_open, &Attr, 0, -1, Leader, 0);
+      if (FD < 0) {
+        if (Leader == -1)
+          return;
+        continue;
+      }
+      if (Leader == -1)
+        Leader = FD;
+      FDs.push_back(FD);
+      Names.push_back(C.Name);
+    }
+#endif
+  }
+
+  ~PerfCounters() {
+#ifdef __linux__
+    for (int FD : FDs)
+      close(FD);
+#endif
+  }
+
+  bool empty() const { return FDs.empty(); }
+  size_t size() const { return FDs.size(); }
+  const char *getName(size_t I) const { return Names[I]; }
+
+  void start() {
+#ifdef __linux__
+    if (!empty())
+      ioctl(FDs[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+  }
+
+  void stop() {
+#ifdef __linux__
+    if (!empty())
+      ioctl(FDs[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+#endif
+  }
+
+  // reads the accumulated value of every counter in the group.
+  bool read(llvm::SmallVectorImpl<uint64_t> &Values) {
+#ifdef __linux__
+    if (empty())
+      return false;
+    // layout for PERF_FORMAT_GROUP: { u64 nr; u64 values[nr]; }
+    llvm::SmallVector<uint64_t, 8> Buf(FDs.size() + 1);
+    ssize_t Len = ::read(FDs[0], Buf.data(), Buf.size() * sizeof(uint64_t));
+    if (Len != static_cast<ssize_t>(Buf.size() * sizeof(uint64_t)))
+      return false;
+    Values.assign(Buf.begin() + 1, Buf.end());
+    return true;
+#else
+    return false;
+#endif
+  }
+};
+
+llvm::Error pinToCPU(int CPU) {
+#ifdef __linux__
+  cpu_set_t Set;
+  CPU_ZERO(&Set);
+  CPU_SET(CPU, &Set);
+  if (int Err = pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set))
+    return llvm::createStringError(
+        std::error_code(Err, std::generic_category()),
+        "failed to pin to cpu %d", CPU);
+  return llvm::Error::success();
+#else
+  return llvm::createStringError(llvm::errc::not_supported,
+                                 "cpu pinning is not supported on this host");
+#endif
+}
+
+double percentile(const std::vector<double> &Sorted, double P) {
+  // nearest-rank percentile
+  size_t Rank = static_cast<size_t>(std::ceil(P / 100.0 * Sorted.size()));
+  return Sorted[Rank == 0 ? 0 : Rank - 1];
+}
+
+} // anonymous namespace
+
+llvm::Error runBenchmark(void (*Fn)(), const BenchOptions &Opts,
+                         llvm::raw_ostream &OS) {
+  if (Opts.Runs == 0) {
+    return llvm::createStringError(llvm::errc::invalid_argument,
+                                   "benchmark needs at least one run");
+  }
+
+  if (Opts.CPU >= 0) {
+    if (auto Err = pinToCPU(Opts.CPU))
+      return Err;
+  }
+
+  for (unsigned i = 0; i < Opts.Warmup; i++) {
+    Fn();
+  }
+
+  PerfCounters PC;
+  std::vector<double> Samples;
+  Samples.reserve(Opts.Runs);
+
+  PC.start();
+  for (unsigned i = 0; i < Opts.Runs; i++) {
+    auto Begin = std::chrono::steady_clock::now();
+    Fn();
+    auto End = std::chrono::steady_clock::now();
+    Samples.push_back(
+        std::chrono::duration<double, std::micro>(End - Begin).count());
+  }
+  PC.stop();
+
+  double Sum = 0;
+  for (double S : Samples)
+    Sum += S;
+  double Mean = Sum / Samples.size();
+
+  double Var = 0;
+  for (double S : Samples)
+    Var += (S - Mean) * (S - Mean);
+  double StdDev =
+      Samples.size() > 1 ? std::sqrt(Var / (Samples.size() - 1)) : 0;
+
+  std::sort(Samples.begin(), Samples.end());
+
+  OS << "runs: " << Opts.Runs << " (warmup " << Opts.Warmup << ")";
+  if (Opts.CPU >= 0)
+    OS << ", pinned to cpu " << Opts.CPU;
+  OS << "\n";
+  OS << llvm::format("  min:    %12.3f us\n", Samples.front());
+  OS << llvm::format("  median: %12.3f us\n", percentile(Samples, 50));
+  OS << llvm::format("  p99:    %12.3f us\n", percentile(Samples, 99));
+  OS << llvm::format("  mean:   %12.3f us\n", Mean);
+  OS << llvm::format("  stddev: %12.3f us\n", StdDev);
+
+  llvm::SmallVector<uint64_t, 8> Values;
+  if (PC.read(Values)) {
+    OS << "counters (per run):\n";
+    for (size_t i = 0; i < Values.size() && i < PC.size(); i++) {
+      OS << llvm::format("  %-14s %14.1f\n", PC.getName(i),
+                         static_cast<double>(Values[i]) / Opts.Runs);
+    }
+  } else {
+    OS << "counters: perf_event not available\n";
+  }
+
+  return llvm::Error::success();
+}
+
+size_t getPeakRSS() {
+  struct rusage Usage;
+  if (getrusage(RUSAGE_SELF, &Usage))
+    return 0;
+#ifdef __APPLE__
+  return Usage.ru_maxrss;
+#else
+  return static_cast<size_t>(Usage.ru_maxrss) * 1024;
+#endif
+}
+
+} // namespace clang
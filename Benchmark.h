@@ -0,0 +1,29 @@
+#ifndef LLVM_CLANG_TOOLS_CLANG_CCINT_BENCHMARK_H
+#define LLVM_CLANG_TOOLS_CLANG_CCINT_BENCHMARK_H
+
+#include "llvm/Support/Error.h"
+
+namespace llvm {
+class raw_ostream;
+} // namespace llvm
+
+namespace clang {
+
+struct BenchOptions {
+  unsigned Runs = 0;   // number of timed calls
+  unsigned Warmup = 0; // number of untimed calls before measuring
+  int CPU = -1;        // cpu to pin the calling thread to, -1 for none
+};
+
+// calls Fn Opts.Warmup + Opts.Runs times in the current process and prints
+// min/median/p99/stddev of the timed runs to OS. hardware counters are
+// reported as per-run averages when perf_event is available.
+llvm::Error runBenchmark(void (*Fn)(), const BenchOptions &Opts,
+                         llvm::raw_ostream &OS);
+
+// high-water mark of the resident set of this process in bytes.
+size_t getPeakRSS();
+
+} // namespace clang
+
+#endif // LLVM_CLANG_TOOLS_CLANG_CCINT_BENCHMARK_H
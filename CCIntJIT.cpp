@@ -1,57 +1,534 @@
 #include "CCIntJIT.h"
+#include "CodeCache.h"
+#include "RemoteExecutor.h"
+#include "Runtime.h"
+
 #include "clang/Basic/TargetInfo.h"
 #include "clang/Basic/TargetOptions.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Demangle/Demangle.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/EPCDynamicLibrarySearchGenerator.h"
+#include "llvm/ExecutionEngine/Orc/EPCEHFrameRegistrar.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
 #include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/ObjectTransformLayer.h"
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Object/ObjectFile.h"
 #include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Errc.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+
+#include <vector>
 
 namespace clang {
 
+namespace {
+
+// resolves a fixed set of host functions by name. added in front of the
+// process search generator, so these take precedence over libc while a
+// definition in the script itself still wins.
+class HostSymbolGenerator : public llvm::orc::DefinitionGenerator {
+  llvm::StringMap<void *> Symbols;
+  char GlobalPrefix;
+
+public:
+  HostSymbolGenerator(llvm::StringMap<void *> Syms, char Prefix)
+      : Symbols(std::move(Syms)), GlobalPrefix(Prefix) {}
+
+  llvm::Error
+  tryToGenerate(llvm::orc::LookupState &LS, llvm::orc::LookupKind K,
+                llvm::orc::JITDylib &JD,
+                llvm::orc::JITDylibLookupFlags JDLookupFlags,
+                const llvm::orc::SymbolLookupSet &LookupSet) override {
+    llvm::orc::SymbolMap NewSymbols;
+    for (auto &KV : LookupSet) {
+      llvm::StringRef Name = *KV.first;
+      if (GlobalPrefix != '\0') {
+        if (!Name.consume_front(llvm::StringRef(&GlobalPrefix, 1)))
+          continue;
+      }
+
+      auto It = Symbols.find(Name);
+      if (It == Symbols.end())
+        continue;
+
+      NewSymbols[KV.first] = llvm::JITEvaluatedSymbol(
+          llvm::pointerToJITTargetAddress(It->second),
+          llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable);
+    }
+
+    if (NewSymbols.empty())
+      return llvm::Error::success();
+
+    return JD.define(llvm::orc::absoluteSymbols(std::move(NewSymbols)));
+  }
+};
+
+// prefers the libomp next to the clang that compiles the script, then
+// whatever the dynamic loader finds.
+llvm::Error loadOpenMPRuntime(CCIntJIT &J) {
+#ifdef __APPLE__
+  const char *Ext = ".dylib";
+#else
+  const char *Ext = ".so";
+#endif
+  llvm::SmallString<256> Bundled(getLibraryDir());
+  llvm::sys::path::append(Bundled, llvm::Twine("libomp") + Ext);
+
+  std::string ErrMsg;
+  for (const std::string &Name :
+       {std::string(Bundled.str()), std::string("libomp") + Ext,
+        std::string("libomp.so.5")}) {
+    llvm::Error Err = J.AddDynamicLib(Name);
+    if (!Err)
+      return llvm::Error::success();
+    ErrMsg = llvm::toString(std::move(Err));
+  }
+  return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                 "cannot load the openmp runtime: %s",
+                                 ErrMsg.c_str());
+}
+
+// libomp keeps a list of the threadprivate caches of jit'd code and clears
+// them when the process exits, after the code is gone. a hard pause lets go
+// of them now; the runtime starts up again on its next use.
+void pauseOpenMPRuntime() {
+  using PauseFunction = int (*)(int);
+  auto Pause = reinterpret_cast<PauseFunction>(
+      llvm::sys::DynamicLibrary::SearchForAddressOfSymbol(
+          "omp_pause_resource_all"));
+  if (Pause)
+    Pause(/*omp_pause_hard=*/2);
+}
+
+llvm::Error executorGone() {
+  return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                 "the executor is gone");
+}
+
+// neither runtimedyld nor jitlink without a platform runtime can allocate
+// thread-local storage, and code using it would fail to link with a
+// relocation error, or crash
+llvm::Error rejectThreadLocals(const llvm::Module &M) {
+  for (const llvm::GlobalVariable &GV : M.globals()) {
+    if (!GV.isThreadLocal())
+      continue;
+    return llvm::createStringError(
+        llvm::errc::not_supported,
+        "thread_local variable '%s' is not supported: the jit cannot "
+        "allocate thread-local storage",
+        llvm::demangle(GV.getName().str()).c_str());
+  }
+  return llvm::Error::success();
+}
+
+// the functions of ccint.h live in this process, the executor has none
+llvm::Error rejectRuntimeCalls(const llvm::Module &M) {
+  llvm::StringMap<void *> Runtime;
+  getRuntimeSymbols(Runtime, nullptr);
+  for (const llvm::Function &F : M) {
+    if (!F.isDeclaration() || !Runtime.count(F.getName()))
+      continue;
+    return llvm::createStringError(
+        llvm::errc::not_supported,
+        "%s is not available with --oop-executor: <ccint.h> needs the "
+        "script to run in-process",
+        F.getName().str().c_str());
+  }
+  return llvm::Error::success();
+}
+
+// errors about symbols hold on to the string pool of the session, which
+// must not outlive it
+llvm::Error detachFromSession(llvm::Error Err) {
+  if (!Err)
+    return Err;
+  return llvm::make_error<llvm::StringError>(llvm::toString(std::move(Err)),
+                                             llvm::inconvertibleErrorCode());
+}
+
+} // anonymous namespace
+
 CCIntJIT::CCIntJIT(llvm::orc::ThreadSafeContext &TSC, llvm::Error &Err,
-                   const clang::TargetInfo &TI)
-    : TSCtx(TSC) {
+                   const clang::TargetInfo &TI, const CCIntJITOptions &Options)
+    : TSCtx(TSC), Opts(Options) {
 
   using namespace llvm::orc;
   llvm::ErrorAsOutParameter EAO(&Err);
 
   auto JTMB = JITTargetMachineBuilder(TI.getTriple());
   JTMB.addFeatures(TI.getTargetOpts().Features);
-  if (auto JitOrErr = LLJITBuilder().setJITTargetMachineBuilder(JTMB).create())
+  LLJITBuilder Builder;
+  if (Opts.NumCompileThreads > 1)
+    Builder.setNumCompileThreads(Opts.NumCompileThreads);
+
+  if (isOutOfProcess()) {
+    // the code cache and the allocator live in this process
+    if (!Opts.CodeCacheDir.empty() ||
+        Opts.Allocator != AllocatorKind::System) {
+      Err = llvm::createStringError(
+          llvm::inconvertibleErrorCode(),
+          "--code-cache and --allocator need in-process execution");
+      return;
+    }
+
+    auto EPC = launchExecutor(Opts.ExecutorPath, ExecutorPID);
+    if (!EPC) {
+      Err = EPC.takeError();
+      return;
+    }
+    Builder.setExecutorProcessControl(std::move(*EPC));
+
+    // jitlink is not bound to 32-bit absolute relocations, the executor
+    // maps code wherever it likes
+    JTMB.setRelocationModel(llvm::Reloc::PIC_);
+    JTMB.setCodeModel(llvm::CodeModel::Small);
+
+    Builder.setObjectLinkingLayerCreator(
+        [](ExecutionSession &ES, const llvm::Triple &)
+            -> llvm::Expected<std::unique_ptr<ObjectLayer>> {
+          auto Layer = std::make_unique<ObjectLinkingLayer>(
+              ES, ES.getExecutorProcessControl().getMemMgr());
+          auto Registrar = EPCEHFrameRegistrar::Create(ES);
+          if (!Registrar)
+            return Registrar.takeError();
+          Layer->addPlugin(std::make_unique<EHFrameRegistrationPlugin>(
+              ES, std::move(*Registrar)));
+          return std::move(Layer);
+        });
+
+    // the wrapper of a call into a script is compiled while the next script
+    // may be compiled on another thread, which a single compiler cannot do
+    Builder.setCompileFunctionCreator(
+        [](JITTargetMachineBuilder JTMB)
+            -> llvm::Expected<std::unique_ptr<IRCompileLayer::IRCompiler>> {
+          return std::make_unique<ConcurrentIRCompiler>(std::move(JTMB));
+        });
+
+    // the generic platform runs initializers in this process. constructors
+    // are scraped in addModule instead, exit handlers are covered by the
+    // executor runtime below.
+    Builder.setPlatformSetUp(setUpInactivePlatform);
+  }
+
+  if (!Opts.CodeCacheDir.empty()) {
+    if (auto EC = llvm::sys::fs::create_directories(Opts.CodeCacheDir)) {
+      Err = llvm::createStringError(EC, "cannot create code cache %s",
+                                    Opts.CodeCacheDir.c_str());
+      return;
+    }
+
+    // pc-relative code that reaches everything else through the got is
+    // byte-identical in every process, which is what makes it shareable
+    JTMB.setRelocationModel(llvm::Reloc::PIC_);
+    JTMB.setCodeModel(llvm::CodeModel::Small);
+
+    // a timestamp file in the directory limits the scans to one per
+    // prune_interval across all processes
+    if (auto E = pruneCodeCache(Opts.CodeCacheDir, Opts.CodeCachePolicy)) {
+      Err = std::move(E);
+      return;
+    }
+
+    std::string Dir = Opts.CodeCacheDir;
+    Builder.setCompileFunctionCreator(
+        [Dir](JITTargetMachineBuilder JTMB)
+            -> llvm::Expected<std::unique_ptr<IRCompileLayer::IRCompiler>> {
+          return createCachingCompiler(std::move(JTMB), Dir);
+        });
+
+    Builder.setObjectLinkingLayerCreator(
+        [Dir](ExecutionSession &ES, const llvm::Triple &TT)
+            -> llvm::Expected<std::unique_ptr<ObjectLayer>> {
+          auto Layer = std::make_unique<RTDyldObjectLinkingLayer>(
+              ES, [Dir]() { return createSharedCodeMemoryManager(Dir); });
+          if (TT.isOSBinFormatCOFF()) {
+            Layer->setOverrideObjectFlagsWithResponsibilityFlags(true);
+            Layer->setAutoClaimResponsibilityForObjectSymbols(true);
+          }
+          return std::move(Layer);
+        });
+  }
+
+  Builder.setJITTargetMachineBuilder(JTMB);
+
+  if (auto JitOrErr = Builder.create()) {
     Jit = std::move(*JitOrErr);
-  else {
+    Alive = true;
+  } else {
     Err = JitOrErr.takeError();
     return;
   }
 
-  if (auto GeneratorOrErr = DynamicLibrarySearchGenerator::GetForCurrentProcess(
-          Jit->getDataLayout().getGlobalPrefix())) {
+  // sizes every object on its way to the linker; runs on the compile threads
+  Jit->getObjTransformLayer().setTransform(
+      [this](std::unique_ptr<llvm::MemoryBuffer> Obj)
+          -> llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> {
+        auto ObjFile =
+            llvm::object::ObjectFile::createObjectFile(Obj->getMemBufferRef());
+        if (!ObjFile)
+          return ObjFile.takeError();
+
+        size_t Size = 0;
+        for (const llvm::object::SectionRef &Sec : (*ObjFile)->sections()) {
+          if (Sec.isText())
+            Size += Sec.getSize();
+        }
+        CodeSize += Size;
+        return std::move(Obj);
+      });
+
+  if (isOutOfProcess()) {
+    auto GeneratorOrErr = EPCDynamicLibrarySearchGenerator::GetForTargetProcess(
+        Jit->getExecutionSession());
+    if (!GeneratorOrErr) {
+      Err = GeneratorOrErr.takeError();
+      return;
+    }
     Jit->getMainJITDylib().addGenerator(std::move(*GeneratorOrErr));
+
+    auto Ctx = std::make_unique<llvm::LLVMContext>();
+    auto Runtime =
+        createExecutorRuntime(*Ctx, Jit->getDataLayout(), Opts.OpenMP);
+    if (auto E = Jit->addIRModule(
+            ThreadSafeModule(std::move(Runtime), std::move(Ctx)))) {
+      Err = std::move(E);
+      return;
+    }
   } else {
-    Err = GeneratorOrErr.takeError();
-    return;
+    llvm::StringMap<void *> Symbols;
+    getRuntimeSymbols(Symbols, Opts.Inputs);
+    if (Opts.Allocator != AllocatorKind::System) {
+      installAllocator(Opts.Allocator, Opts.AllocatorStats);
+      getAllocatorSymbols(Symbols);
+    }
+    Jit->getMainJITDylib().addGenerator(std::make_unique<HostSymbolGenerator>(
+        std::move(Symbols), Jit->getDataLayout().getGlobalPrefix()));
+
+    auto GeneratorOrErr = DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        Jit->getDataLayout().getGlobalPrefix());
+    if (!GeneratorOrErr) {
+      Err = GeneratorOrErr.takeError();
+      return;
+    }
+    Jit->getMainJITDylib().addGenerator(std::move(*GeneratorOrErr));
+  }
+
+  // in-process, the process generator also searches permanently loaded
+  // libraries
+  if (Opts.OpenMP) {
+    if (auto E = loadOpenMPRuntime(*this)) {
+      Err = std::move(E);
+      return;
+    }
   }
 }
 
-CCIntJIT::~CCIntJIT() {}
+CCIntJIT::~CCIntJIT() {
+  if (Opts.OpenMP && !isOutOfProcess())
+    pauseOpenMPRuntime();
+
+  if (!isOutOfProcess() || ExecutorPID < 0)
+    return;
+
+  // exit handlers of jit'd code have to run while the executor still has
+  // the code mapped
+  llvm::Error Err = Jit ? runExitHandlers(Jit->getMainJITDylib())
+                        : llvm::Error::success();
+  Err = shutDownExecutor(std::move(Err));
+  if (Err)
+    llvm::logAllUnhandledErrors(std::move(Err), llvm::errs(), "error: ");
+}
 
 llvm::Error CCIntJIT::addModule(std::unique_ptr<llvm::Module> TheModule) {
-  llvm::orc::ResourceTrackerSP RT =
-      Jit->getMainJITDylib().createResourceTracker();
-  ResourceTrackers[TheModule.get()] = RT;
+  if (!Jit)
+    return executorGone();
+  return addModule(Jit->getMainJITDylib(), std::move(TheModule));
+}
 
-  return Jit->addIRModule(RT, {std::move(TheModule), TSCtx});
+llvm::Error CCIntJIT::addModule(llvm::orc::JITDylib &JD,
+                                std::unique_ptr<llvm::Module> TheModule) {
+  std::shared_lock<std::shared_timed_mutex> SessionLock(SessionMutex);
+  if (!Jit)
+    return executorGone();
+
+  if (auto Err = rejectThreadLocals(*TheModule))
+    return Err;
+  if (isOutOfProcess()) {
+    if (auto Err = rejectRuntimeCalls(*TheModule))
+      return Err;
+  }
+
+  // a module that hands its memory to host code which may free it gets
+  // libc instead of the built-in allocator. the script's own dylib is
+  // searched before the main one, where the replacements live.
+  if (!isOutOfProcess() && Opts.Allocator != AllocatorKind::System &&
+      !findOwnershipTransfer(*TheModule).empty()) {
+    if (auto Err = useSystemAllocator(JD, *TheModule))
+      return Err;
+  }
+
+  llvm::orc::ResourceTrackerSP RT = JD.createResourceTracker();
+  {
+    std::lock_guard<std::mutex> Lock(StateMutex);
+    ResourceTrackers[TheModule.get()] = RT;
+  }
+
+  if (isOutOfProcess()) {
+    std::string Ctors =
+        "__ccint_run_ctors." + std::to_string(NumEntryFunctions++);
+    bool HasCtors = scrapeConstructors(*TheModule, Ctors);
+    std::string Dtors =
+        "__ccint_run_global_dtors." + std::to_string(NumEntryFunctions++);
+    bool HasDtors = scrapeDestructors(*TheModule, Dtors);
+
+    std::lock_guard<std::mutex> Lock(StateMutex);
+    EntryFunctions &E = Entries[&JD];
+    if (HasCtors)
+      E.Ctors.push_back(Ctors);
+    if (HasDtors)
+      E.Dtors.push_back({TheModule.get(), Dtors});
+  }
+
+  // when the executor dies meanwhile, the thread running the script tears
+  // the session down as soon as it is released
+  return detachFromSession([&]() -> llvm::Error {
+    if (Opts.NumCompileThreads > 1)
+      return addPartitionedModule(RT, std::move(TheModule));
+
+    if (!isOutOfProcess())
+      return Jit->addIRModule(RT, {std::move(TheModule), TSCtx});
+
+    // linking the whole module up front resolves its external symbols in a
+    // single batched lookup in the executor and writes its memory in one
+    // go, before the first call into it
+    llvm::orc::SymbolLookupSet Symbols;
+    addDefinitions(*TheModule, Symbols);
+    if (auto Err = Jit->addIRModule(RT, {std::move(TheModule), TSCtx}))
+      return Err;
+    return materialize(JD, std::move(Symbols));
+  }());
+}
+
+void CCIntJIT::addDefinitions(const llvm::Module &M,
+                              llvm::orc::SymbolLookupSet &Symbols) {
+  for (const llvm::GlobalValue &GV : M.global_values()) {
+    if (GV.isDeclaration() || GV.hasLocalLinkage() ||
+        GV.hasAvailableExternallyLinkage() || GV.getName().startswith("llvm."))
+      continue;
+    Symbols.add(Jit->mangleAndIntern(GV.getName()),
+                llvm::orc::SymbolLookupFlags::WeaklyReferencedSymbol);
+  }
+}
+
+llvm::Error CCIntJIT::materialize(llvm::orc::JITDylib &JD,
+                                  llvm::orc::SymbolLookupSet Symbols) {
+  using namespace llvm::orc;
+
+  auto Result = Jit->getExecutionSession().lookup(
+      makeJITDylibSearchOrder(&JD, JITDylibLookupFlags::MatchAllSymbols),
+      std::move(Symbols));
+  if (!Result)
+    return Result.takeError();
+
+  return llvm::Error::success();
+}
+
+llvm::Error
+CCIntJIT::addPartitionedModule(llvm::orc::ResourceTrackerSP RT,
+                               std::unique_ptr<llvm::Module> TheModule) {
+  using namespace llvm::orc;
+
+  // SplitModule is deterministic: a global always lands in the same
+  // partition for the same input, so the generated code does not depend on
+  // thread scheduling.
+  std::vector<llvm::SmallVector<char, 0>> Parts;
+  llvm::SplitModule(*TheModule, Opts.NumCompileThreads,
+                    [&](std::unique_ptr<llvm::Module> MPart) {
+                      // partitions that did not get the special arrays keep
+                      // external declarations of them, which the ctor
+                      // scraper and the backend do not expect.
+                      for (const char *Name :
+                           {"llvm.global_ctors", "llvm.global_dtors",
+                            "llvm.used", "llvm.compiler.used"}) {
+                        auto *GV = MPart->getNamedGlobal(Name);
+                        if (GV && GV->isDeclaration())
+                          GV->eraseFromParent();
+                      }
+                      Parts.emplace_back();
+                      llvm::raw_svector_ostream OS(Parts.back());
+                      llvm::WriteBitcodeToFile(*MPart, OS);
+                    });
+  TheModule.reset();
+
+  // every partition gets its own context so that the compile threads never
+  // contend on a context lock.
+  SymbolLookupSet Symbols;
+  for (auto &Part : Parts) {
+    auto Ctx = std::make_unique<llvm::LLVMContext>();
+    auto M = llvm::parseBitcodeFile(
+        llvm::MemoryBufferRef(llvm::StringRef(Part.data(), Part.size()),
+                              "ccint-partition"),
+        *Ctx);
+    if (!M)
+      return M.takeError();
+
+    addDefinitions(**M, Symbols);
+
+    if (auto Err = Jit->addIRModule(
+            RT, ThreadSafeModule(std::move(*M), std::move(Ctx))))
+      return Err;
+  }
+
+  // the jit is lazy by default; looking up everything at once hands all
+  // partitions to the compile thread pool together.
+  return materialize(RT->getJITDylib(), std::move(Symbols));
+}
+
+llvm::Error CCIntJIT::useSystemAllocator(llvm::orc::JITDylib &JD,
+                                         const llvm::Module &M) {
+  llvm::StringMap<void *> System;
+  getSystemAllocatorSymbols(System);
+
+  llvm::orc::SymbolMap Symbols;
+  for (const llvm::Function &F : M) {
+    auto It = System.find(F.getName());
+    if (!F.isDeclaration() || It == System.end())
+      continue;
+    Symbols[Jit->mangleAndIntern(F.getName())] = llvm::JITEvaluatedSymbol(
+        llvm::pointerToJITTargetAddress(It->second),
+        llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable);
+  }
+  if (Symbols.empty())
+    return llvm::Error::success();
+
+  // an earlier module of the main dylib may have bound the replacements
+  // already
+  if (auto Err = JD.define(llvm::orc::absoluteSymbols(std::move(Symbols)))) {
+    return llvm::createStringError(
+        llvm::inconvertibleErrorCode(),
+        "cannot fall back to libc for %s: %s",
+        findOwnershipTransfer(M).str().c_str(),
+        llvm::toString(std::move(Err)).c_str());
+  }
+  return llvm::Error::success();
 }
 
 llvm::Error CCIntJIT::removeModule(std::unique_ptr<llvm::Module> TheModule) {
+  std::lock_guard<std::mutex> Lock(StateMutex);
 
   llvm::orc::ResourceTrackerSP RT =
       std::move(ResourceTrackers[TheModule.get()]);
@@ -59,18 +536,228 @@ llvm::Error CCIntJIT::removeModule(std::unique_ptr<llvm::Module> TheModule) {
     return llvm::Error::success();
 
   ResourceTrackers.erase(TheModule.get());
+  auto It = Entries.find(&RT->getJITDylib());
+  if (It != Entries.end()) {
+    llvm::erase_if(
+        It->second.Dtors,
+        [&](const std::pair<const llvm::Module *, std::string> &D) {
+          return D.first == TheModule.get();
+        });
+  }
   if (llvm::Error Err = RT->remove())
     return Err;
   return llvm::Error::success();
 }
 
-llvm::Error CCIntJIT::runCtors() const {
-  return Jit->initialize(Jit->getMainJITDylib());
+llvm::Error CCIntJIT::runCtors() {
+  if (!Jit)
+    return executorGone();
+  return runCtors(Jit->getMainJITDylib());
+}
+
+llvm::Error CCIntJIT::runCtors(llvm::orc::JITDylib &JD) {
+  return withSession([&]() -> llvm::Error {
+    if (!isOutOfProcess())
+      return Jit->initialize(JD);
+
+    std::vector<std::string> Names;
+    {
+      std::lock_guard<std::mutex> Lock(StateMutex);
+      Names = std::move(Entries[&JD].Ctors);
+      Entries[&JD].Ctors.clear();
+    }
+    for (const std::string &Name : Names) {
+      if (auto Err = runInExecutor(JD, Name))
+        return Err;
+    }
+    return llvm::Error::success();
+  });
+}
+
+llvm::Error CCIntJIT::callFunction(llvm::StringRef Name) {
+  if (!Jit)
+    return executorGone();
+  return callFunction(Jit->getMainJITDylib(), Name);
+}
+
+llvm::Error CCIntJIT::callFunction(llvm::orc::JITDylib &JD,
+                                   llvm::StringRef Name) {
+  return withSession([&]() -> llvm::Error {
+    if (!isOutOfProcess()) {
+      auto Addr = getSymbolAddress(JD, Name);
+      if (!Addr)
+        return Addr.takeError();
+      reinterpret_cast<void (*)()>(*Addr)();
+      return llvm::Error::success();
+    }
+
+    // the executor only runs main-shaped functions, so Name is called
+    // through a wrapper that goes away again afterwards
+    std::string Entry =
+        "__ccint_call." + std::to_string(NumEntryFunctions++);
+    auto Ctx = std::make_unique<llvm::LLVMContext>();
+    auto Wrapper =
+        createEntryWrapper(*Ctx, Jit->getDataLayout(), Entry, Name);
+    llvm::orc::ResourceTrackerSP RT = JD.createResourceTracker();
+    if (auto Err = Jit->addIRModule(
+            RT,
+            llvm::orc::ThreadSafeModule(std::move(Wrapper), std::move(Ctx))))
+      return Err;
+
+    // after a crash the wrapper goes with the session
+    llvm::Error Err = runInExecutor(JD, Entry);
+    if (ExecutorLost)
+      return Err;
+    return llvm::joinErrors(std::move(Err), RT->remove());
+  });
+}
+
+llvm::Expected<llvm::orc::JITDylib &> CCIntJIT::createScript() {
+  std::shared_lock<std::shared_timed_mutex> SessionLock(SessionMutex);
+  if (!Jit)
+    return executorGone();
+
+  auto JD = Jit->createJITDylib("script." + std::to_string(NumScripts++));
+  if (!JD)
+    return JD.takeError();
+  JD->addToLinkOrder(Jit->getMainJITDylib());
+  return *JD;
+}
+
+llvm::Error CCIntJIT::dropScript(llvm::orc::JITDylib &JD) {
+  std::shared_lock<std::shared_timed_mutex> SessionLock(SessionMutex);
+  if (!Jit)
+    return llvm::Error::success();
+  return removeDylib(JD);
+}
+
+llvm::Error CCIntJIT::removeScript(llvm::orc::JITDylib &JD) {
+  // a crash took the dylib down with the session
+  return withSession(
+      [&]() -> llvm::Error {
+        llvm::Error Err =
+            isOutOfProcess() ? runExitHandlers(JD) : Jit->deinitialize(JD);
+        if (ExecutorLost)
+          return Err;
+        if (Opts.OpenMP && !isOutOfProcess())
+          pauseOpenMPRuntime();
+        return llvm::joinErrors(std::move(Err), removeDylib(JD));
+      },
+      /*MustBeAlive=*/false);
+}
+
+llvm::Error CCIntJIT::removeDylib(llvm::orc::JITDylib &JD) {
+  {
+    std::lock_guard<std::mutex> Lock(StateMutex);
+    Entries.erase(&JD);
+    for (auto It = ResourceTrackers.begin(), E = ResourceTrackers.end();
+         It != E;) {
+      auto Cur = It++;
+      if (&Cur->second->getJITDylib() == &JD)
+        ResourceTrackers.erase(Cur);
+    }
+  }
+  return Jit->getExecutionSession().removeJITDylib(JD);
+}
+
+llvm::Error CCIntJIT::withSession(llvm::function_ref<llvm::Error()> F,
+                                  bool MustBeAlive) {
+  llvm::Error Err = [&]() -> llvm::Error {
+    std::shared_lock<std::shared_timed_mutex> SessionLock(SessionMutex);
+    if (!Jit)
+      return MustBeAlive ? executorGone() : llvm::Error::success();
+    // the error of a script may name symbols of its dylib, which is gone
+    // by the time the error is reported
+    return detachFromSession(F());
+  }();
+  if (ExecutorLost)
+    return shutDownExecutor(std::move(Err));
+  return Err;
+}
+
+llvm::Error CCIntJIT::runInExecutor(llvm::orc::JITDylib &JD,
+                                    llvm::StringRef Name) {
+  auto Addr = getSymbolAddress(JD, Name);
+  if (!Addr)
+    return Addr.takeError();
+
+  auto &EPC = Jit->getExecutionSession().getExecutorProcessControl();
+  auto Result = EPC.runAsMain(llvm::orc::ExecutorAddr(*Addr), {});
+  if (Result)
+    return llvm::Error::success();
+
+  // a crash shows up as a broken connection
+  ExecutorLost = true;
+  return Result.takeError();
+}
+
+llvm::Error CCIntJIT::runExitHandlers(llvm::orc::JITDylib &JD) {
+  // as in a process that exits, the atexit list goes first, then
+  // llvm.global_dtors, those of the module added last first
+  llvm::orc::JITDylib &Main = Jit->getMainJITDylib();
+  std::vector<std::pair<llvm::orc::JITDylib *, std::string>> Names = {
+      {&Main, "__ccint_run_dtors"}};
+  {
+    std::lock_guard<std::mutex> Lock(StateMutex);
+    auto It = Entries.find(&JD);
+    if (It != Entries.end()) {
+      auto &Dtors = It->second.Dtors;
+      for (auto D = Dtors.rbegin(), E = Dtors.rend(); D != E; ++D)
+        Names.push_back({&JD, D->second});
+      Dtors.clear();
+    }
+  }
+
+  Names.push_back({&Main, "__ccint_finish"});
+
+  for (auto &Name : Names) {
+    if (auto Err = runInExecutor(*Name.first, Name.second))
+      return Err;
+  }
+  return llvm::Error::success();
+}
+
+llvm::Error CCIntJIT::shutDownExecutor(llvm::Error Err) {
+  // waits for a script being added on another thread
+  std::unique_lock<std::shared_timed_mutex> SessionLock(SessionMutex);
+  if (ExecutorPID < 0)
+    return Err;
+
+  // ending the session disconnects in any case, after which the executor
+  // can be reaped. the trackers refer to the session and go first. once the
+  // executor is lost, the session's own reports of the disconnect would
+  // only repeat Err.
+  if (Jit && ExecutorLost) {
+    Jit->getExecutionSession().setErrorReporter(
+        [](llvm::Error Err) { llvm::consumeError(std::move(Err)); });
+  }
+  Err = detachFromSession(std::move(Err));
+  {
+    std::lock_guard<std::mutex> Lock(StateMutex);
+    ResourceTrackers.clear();
+    Entries.clear();
+  }
+  Alive = false;
+  Jit.reset();
+  pid_t PID = ExecutorPID;
+  ExecutorPID = -1;
+  return reapExecutor(PID, std::move(Err));
 }
 
 llvm::Expected<llvm::JITTargetAddress>
 CCIntJIT::getSymbolAddress(llvm::StringRef Name) const {
-  auto Sym = Jit->lookup(Name);
+  if (!Jit)
+    return executorGone();
+  return getSymbolAddress(Jit->getMainJITDylib(), Name);
+}
+
+llvm::Expected<llvm::JITTargetAddress>
+CCIntJIT::getSymbolAddress(llvm::orc::JITDylib &JD,
+                           llvm::StringRef Name) const {
+  if (!Jit)
+    return executorGone();
+
+  auto Sym = Jit->lookup(JD, Name);
 
   if (!Sym)
     return Sym.takeError();
@@ -89,6 +776,16 @@ llvm::Error CCIntJIT::AddStaticLib(llvm::StringRef Path) {
 }
 
 llvm::Error CCIntJIT::AddDynamicLib(llvm::StringRef Path) {
+  if (isOutOfProcess()) {
+    auto G = llvm::orc::EPCDynamicLibrarySearchGenerator::Load(
+        Jit->getExecutionSession(), Path.str().c_str());
+    if (!G)
+      return G.takeError();
+
+    Jit->getMainJITDylib().addGenerator(std::move(*G));
+    return llvm::Error::success();
+  }
+
   std::string ErrMsg;
   if (llvm::sys::DynamicLibrary::LoadLibraryPermanently(Path.data(), &ErrMsg)) {
     return llvm::createStringError(llvm::inconvertibleErrorCode(), ErrMsg);
@@ -1,14 +1,26 @@
 #ifndef LLVM_CLANG_TOOLS_CLANG_CCINT_CCINT_JIT_H
 #define LLVM_CLANG_TOOLS_CLANG_CCINT_CCINT_JIT_H
 
+#include "Allocator.h"
+
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
 
 namespace llvm {
 class Error;
 namespace orc {
+class JITDylib;
 class LLJIT;
 class ThreadSafeContext;
 } // namespace orc
@@ -16,27 +28,155 @@ class ThreadSafeContext;
 
 namespace clang {
 
+class InputBuffers;
 class TargetInfo;
 
+struct CCIntJITOptions {
+  // number of backend compile threads. when greater than one, modules are
+  // split into that many partitions, each in its own context, and compiled
+  // eagerly in parallel.
+  unsigned NumCompileThreads = 0;
+
+  // allocator that malloc/free and operator new/delete in jit'd code
+  // resolve to.
+  AllocatorKind Allocator = AllocatorKind::System;
+  bool AllocatorStats = false;
+
+  // when set, compiled objects are cached in this directory and the
+  // relocated code pages are mapped from it, shared between processes that
+  // run the same script.
+  std::string CodeCacheDir;
+
+  // how CodeCacheDir is pruned, see llvm::parseCachePruningPolicy
+  std::string CodeCachePolicy;
+
+  // buffers ccint_map_input hands out to scripts of this jit. must outlive
+  // the jit.
+  const InputBuffers *Inputs = nullptr;
+
+  // load libomp so that the __kmpc_* calls emitted for -fopenmp resolve.
+  bool OpenMP = false;
+
+  // when set, jit'd code runs in a child process started from this
+  // llvm-jitlink-executor binary instead of in-process. compilation and
+  // linking stay in the calling process.
+  std::string ExecutorPath;
+};
+
 class CCIntJIT {
   std::unique_ptr<llvm::orc::LLJIT> Jit;
+  // whether Jit is set. Jit itself may only be read with SessionMutex held,
+  // this can be read without it.
+  std::atomic<bool> Alive{false};
   llvm::orc::ThreadSafeContext &TSCtx;
+  CCIntJITOptions Opts;
 
   llvm::DenseMap<const llvm::Module *, llvm::orc::ResourceTrackerSP>
       ResourceTrackers;
 
+  // bytes of machine code in the text sections of all emitted objects
+  std::atomic<size_t> CodeSize{0};
+
+  // out-of-process only: the executor, and per dylib the entries that run
+  // the constructors of modules added since the last runCtors and those
+  // that run llvm.global_dtors
+  struct EntryFunctions {
+    std::vector<std::string> Ctors;
+    std::vector<std::pair<const llvm::Module *, std::string>> Dtors;
+  };
+  pid_t ExecutorPID = -1;
+  std::atomic<bool> ExecutorLost{false};
+  llvm::DenseMap<const llvm::orc::JITDylib *, EntryFunctions> Entries;
+  std::atomic<unsigned> NumEntryFunctions{0};
+  unsigned NumScripts = 0;
+
+  // a script may run on another thread while the next one is added.
+  // StateMutex guards ResourceTrackers and Entries. SessionMutex is held
+  // shared while the session is in use, so that the thread which finds the
+  // executor gone waits for the other one before tearing the session down.
+  std::mutex StateMutex;
+  std::shared_timed_mutex SessionMutex;
+
 public:
   CCIntJIT(llvm::orc::ThreadSafeContext &TSC, llvm::Error &Err,
-           const clang::TargetInfo &TI);
+           const clang::TargetInfo &TI,
+           const CCIntJITOptions &Options = CCIntJITOptions());
   ~CCIntJIT();
 
+  // without a dylib, these work on the main one
   llvm::Error addModule(std::unique_ptr<llvm::Module> TheModule);
+  llvm::Error addModule(llvm::orc::JITDylib &JD,
+                        std::unique_ptr<llvm::Module> TheModule);
   llvm::Error removeModule(std::unique_ptr<llvm::Module> TheModule);
-  llvm::Error runCtors() const;
+  llvm::Error runCtors();
+  llvm::Error runCtors(llvm::orc::JITDylib &JD);
   llvm::Expected<llvm::JITTargetAddress>
   getSymbolAddress(llvm::StringRef Name) const;
+  llvm::Expected<llvm::JITTargetAddress>
+  getSymbolAddress(llvm::orc::JITDylib &JD, llvm::StringRef Name) const;
   llvm::Error AddStaticLib(llvm::StringRef Path);
   llvm::Error AddDynamicLib(llvm::StringRef Path);
+
+  // calls `void Name()`, in the executor when running out-of-process. a
+  // crash there is returned as an error, after which the jit is unusable.
+  llvm::Error callFunction(llvm::StringRef Name);
+  llvm::Error callFunction(llvm::orc::JITDylib &JD, llvm::StringRef Name);
+
+  // a dylib of its own for one script, which sees the runtime and the
+  // libraries of the main dylib. scripts in separate dylibs can define the
+  // same symbols, so one jit and executor serve any number of them.
+  llvm::Expected<llvm::orc::JITDylib &> createScript();
+
+  // runs the exit handlers of the script in JD and drops its code. the
+  // calls into a script, from runCtors to removeScript, may be made on
+  // another thread than createScript, addModule and dropScript for the
+  // next script.
+  llvm::Error removeScript(llvm::orc::JITDylib &JD);
+
+  // drops the code of a script that never ran
+  llvm::Error dropScript(llvm::orc::JITDylib &JD);
+
+  // false once a crash of the executor took the jit down
+  bool isAlive() const { return Alive; }
+
+  size_t getCodeSize() const { return CodeSize; }
+  bool isOutOfProcess() const { return !Opts.ExecutorPath.empty(); }
+
+private:
+  // binds the allocation functions M calls to libc in JD
+  llvm::Error useSystemAllocator(llvm::orc::JITDylib &JD,
+                                 const llvm::Module &M);
+
+  llvm::Error addPartitionedModule(llvm::orc::ResourceTrackerSP RT,
+                                   std::unique_ptr<llvm::Module> TheModule);
+
+  // adds the symbols M defines to Symbols, and looks them all up in JD at
+  // once
+  void addDefinitions(const llvm::Module &M,
+                      llvm::orc::SymbolLookupSet &Symbols);
+  llvm::Error materialize(llvm::orc::JITDylib &JD,
+                          llvm::orc::SymbolLookupSet Symbols);
+
+  // runs the entry `int Name(int, char **)` of JD in the executor. a broken
+  // connection sets ExecutorLost.
+  llvm::Error runInExecutor(llvm::orc::JITDylib &JD, llvm::StringRef Name);
+
+  // runs what a process does on exit: the atexit handlers, then the
+  // destructors of the modules in JD
+  llvm::Error runExitHandlers(llvm::orc::JITDylib &JD);
+
+  // removes JD from the session
+  llvm::Error removeDylib(llvm::orc::JITDylib &JD);
+
+  // runs F while holding the session, and tears it down afterwards if the
+  // executor was lost. once the session is gone F is not run, which is an
+  // error unless MustBeAlive is false.
+  llvm::Error withSession(llvm::function_ref<llvm::Error()> F,
+                          bool MustBeAlive = true);
+
+  // disconnects and reaps the executor, joining how it died with Err. does
+  // nothing once the executor is gone.
+  llvm::Error shutDownExecutor(llvm::Error Err);
 };
 
 } // end namespace clang
@@ -2,12 +2,15 @@
 #include "Utils.h"
 
 #include "clang/AST/DeclContextInternals.h"
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/SourceManager.h"
 #include "clang/CodeGen/BackendUtil.h"
 #include "clang/CodeGen/CodeGenAction.h"
 #include "clang/CodeGen/ModuleBuilder.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/FrontendTool/Utils.h"
+#include "clang/Lex/PPCallbacks.h"
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Lex/PreprocessorOptions.h"
 #include "clang/Parse/Parser.h"
@@ -17,6 +20,7 @@
 #include "llvm/Option/ArgList.h"
 #include "llvm/Support/CrashRecoveryContext.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Timer.h"
 
 #include <iostream>
@@ -25,9 +29,41 @@
 
 namespace clang {
 
+// the file name that the wrapped statements are included under. the path of
+// the script may hold characters that end or escape the #include, so it is
+// never spelled there.
+static const char *const WrappedBodyName = "/ccint/wrapped-body";
+
+// gives the wrapped statements the presumed location they have in the
+// script, as a #line directive at the top of the body would, so that
+// __FILE__, __LINE__ and diagnostics refer to the script.
+class WrappedBodyLocation : public PPCallbacks {
+  SourceManager &SM;
+  std::string FileName;
+  unsigned Line;
+
+public:
+  WrappedBodyLocation(SourceManager &SM, llvm::StringRef FileName,
+                      unsigned Line)
+      : SM(SM), FileName(FileName.str()), Line(Line) {}
+
+  void FileChanged(SourceLocation Loc, FileChangeReason Reason,
+                   SrcMgr::CharacteristicKind FileType,
+                   FileID PrevFID) override {
+    if (Reason != EnterFile || SM.getFilename(Loc) != WrappedBodyName)
+      return;
+    // a line note names the line after the one it is on
+    SM.AddLineNote(Loc, Line + 1, SM.getLineTableFilenameID(FileName),
+                   /*IsFileEntry=*/false, /*IsFileExit=*/false, FileType);
+  }
+};
+
 class CCIntAction : public WrapperFrontendAction {
 private:
   std::string MangledName;
+  // where the wrapped statements start in the script, if it is wrapped
+  std::string BodyFile;
+  unsigned BodyLine = 0;
 
 public:
   CCIntAction(CompilerInstance &CI, llvm::LLVMContext &LLVMCtx,
@@ -43,7 +79,24 @@ public:
   FrontendAction *getWrapped() const { return WrappedAction.get(); }
   llvm::StringRef GetMangledName() const { return MangledName; };
 
+  void setWrappedBody(llvm::StringRef FileName, unsigned Line) {
+    BodyFile = FileName.str();
+    BodyLine = Line;
+  }
+
+  bool BeginSourceFileAction(CompilerInstance &CI) override {
+    if (!WrapperFrontendAction::BeginSourceFileAction(CI))
+      return false;
+    if (!BodyFile.empty()) {
+      Preprocessor &PP = CI.getPreprocessor();
+      PP.addPPCallbacks(std::make_unique<WrappedBodyLocation>(
+          PP.getSourceManager(), BodyFile, BodyLine));
+    }
+    return true;
+  }
+
   void ExecuteAction() override {
+    MangledName.clear();
     WrapperFrontendAction::ExecuteAction();
     TranslationUnitDecl *TUDecl =
         getCompilerInstance().getASTContext().getTranslationUnitDecl();
@@ -75,33 +128,41 @@ llvm::Error CCIntParser::Parse(llvm::StringRef FileName, bool Wrap) {
     return llvm::createStringError(llvm::errc::not_supported, "parse failed");
   }
 
+  // the compiler instance is kept warm across scripts, but files may have
+  // changed since the last one was parsed: every script gets new file and
+  // source managers, which the action creates again. the diagnostic state
+  // of the last script refers to its source manager and goes too; Reset
+  // also drops the warning options, which are applied again.
+  if (CI->hasSourceManager()) {
+    DiagnosticsEngine &Diags = CI->getDiagnostics();
+    Diags.Reset();
+    ProcessWarningOptions(Diags, CI->getDiagnosticOpts(),
+                          /*ReportDiags=*/false);
+    Diags.getClient()->clear();
+
+    CI->setPreprocessor(nullptr);
+    CI->setSourceManager(nullptr);
+    Diags.setSourceManager(nullptr);
+    CI->setFileManager(nullptr);
+  }
+
   FrontendInputFile InputFile(FileName,
                               CI->getFrontendOpts().Inputs[0].getKind());
 
   CI->getInvocation().getFrontendOpts().Inputs.clear();
   CI->getInvocation().getFrontendOpts().Inputs.push_back(InputFile);
 
-  std::string wrapCode;
+  Act->setWrappedBody("", 0);
   if (Wrap) {
-    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> MBOrErr =
-        llvm::MemoryBuffer::getFile(FileName);
-    if (std::error_code error = MBOrErr.getError()) {
-      return llvm::createStringError(llvm::errc::not_supported,
-                                     "failed to read file: %s",
-                                     error.message().c_str());
+    if (auto Err = WrapInput(FileName)) {
+      return Err;
     }
-
-    llvm::StringRef Code(MBOrErr.get()->getBufferStart(),
-                         MBOrErr.get()->getBufferSize());
-
-    wrapCode = WrapInput(Code.str());
-
-    std::unique_ptr<llvm::MemoryBuffer> MB =
-        llvm::MemoryBuffer::getMemBuffer(wrapCode);
-    CI->getPreprocessorOpts().addRemappedFile(FileName, MB.release());
   }
 
   bool Success = CI->ExecuteAction(*Act);
+  // the source manager does not own remapped buffers and is done with them
+  CI->getPreprocessorOpts().clearRemappedFiles();
+  InputBuffers.clear();
   if (!Success) {
     return llvm::createStringError(llvm::errc::not_supported, "parse failed");
   }
@@ -115,18 +176,47 @@ llvm::StringRef CCIntParser::GetMangledName() const {
   return Act->GetMangledName();
 }
 
-std::string CCIntParser::WrapInput(const std::string &Code) {
-
-  size_t wrapPos = getWrapPos(CI->getLangOpts(), Code);
+llvm::Error CCIntParser::WrapInput(llvm::StringRef FileName) {
+  // large files are mapped rather than read
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> MBOrErr =
+      llvm::MemoryBuffer::getFile(FileName);
+  if (std::error_code error = MBOrErr.getError()) {
+    return llvm::createStringError(llvm::errc::not_supported,
+                                   "failed to read file: %s",
+                                   error.message().c_str());
+  }
 
-  if (wrapPos != std::string::npos) {
-    std::string res = Code.substr(0, wrapPos) + "void ccint_main() {\n" +
-                      Code.substr(wrapPos) + "\n}";
+  std::unique_ptr<llvm::MemoryBuffer> File = std::move(MBOrErr.get());
+  llvm::StringRef Code = File->getBuffer();
 
-    return res;
+  size_t wrapPos = getWrapPos(CI->getLangOpts(), Code);
+  if (wrapPos == llvm::StringRef::npos) {
+    return llvm::Error::success();
   }
 
-  return Code;
+  // the statements are spliced into ccint_main with #include instead of
+  // being copied: the body is a slice of the mapped file that shares its
+  // null terminator, only the directives in front of it are copied. the
+  // action moves the body back to its place in the script.
+  std::unique_ptr<llvm::MemoryBuffer> Body = llvm::MemoryBuffer::getMemBuffer(
+      Code.substr(wrapPos), WrappedBodyName, /*RequiresNullTerminator=*/true);
+  std::unique_ptr<llvm::MemoryBuffer> Main =
+      llvm::MemoryBuffer::getMemBufferCopy(
+          (Code.substr(0, wrapPos) + "void ccint_main() {\n#include \"" +
+           WrappedBodyName + "\"\n}\n")
+              .str(),
+          FileName);
+  Act->setWrappedBody(FileName, 1 + Code.substr(0, wrapPos).count('\n'));
+
+  PreprocessorOptions &PPOpts = CI->getPreprocessorOpts();
+  PPOpts.RetainRemappedFileBuffers = true;
+  PPOpts.addRemappedFile(FileName, Main.get());
+  PPOpts.addRemappedFile(WrappedBodyName, Body.get());
+
+  InputBuffers.push_back(std::move(File));
+  InputBuffers.push_back(std::move(Main));
+  InputBuffers.push_back(std::move(Body));
+  return llvm::Error::success();
 }
 
 } // end namespace clang
@@ -9,8 +9,10 @@
 
 #include <list>
 #include <memory>
+#include <vector>
 namespace llvm {
 class LLVMContext;
+class MemoryBuffer;
 class Module;
 } // namespace llvm
 
@@ -21,6 +23,9 @@ class CCIntAction;
 class Parser;
 
 class CCIntParser {
+  // remapped input buffers of the script being parsed, released when its
+  // parse is done
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> InputBuffers;
   std::unique_ptr<CCIntAction> Act;
   std::shared_ptr<CompilerInstance> CI;
   std::shared_ptr<Parser> P;
@@ -38,7 +43,7 @@ public:
   llvm::Error Parse(llvm::StringRef FileName, bool Wrap);
 
   llvm::StringRef GetMangledName() const;
-  std::string WrapInput(const std::string &Code);
+  llvm::Error WrapInput(llvm::StringRef FileName);
 };
 } // end namespace clang
 
@@ -0,0 +1,289 @@
+#include "CodeCache.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Memory.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace clang {
+
+namespace {
+
+std::string getCachePath(llvm::StringRef Dir, llvm::StringRef Prefix,
+                         llvm::ArrayRef<uint8_t> Data,
+                         llvm::StringRef Suffix) {
+  llvm::SmallString<256> Path(Dir);
+  llvm::sys::path::append(Path, Prefix + llvm::toHex(llvm::SHA1::hash(Data),
+                                                     /*LowerCase=*/true) +
+                                    Suffix);
+  return std::string(Path.str());
+}
+
+// writes Data to a temporary file in Dir and renames it to Path. concurrent
+// writers race harmlessly since they all write the same content, and readers
+// never see a partial file. the file is read-only from the start, since
+// processes map code from it.
+bool publish(llvm::StringRef Dir, llvm::StringRef Path,
+             llvm::ArrayRef<uint8_t> Data) {
+  llvm::SmallString<256> Model(Dir);
+  llvm::sys::path::append(Model, "tmp-%%%%%%%%");
+
+  int FD;
+  llvm::SmallString<256> TmpPath;
+  if (llvm::sys::fs::createUniqueFile(Model, FD, TmpPath,
+                                      llvm::sys::fs::OF_None,
+                                      llvm::sys::fs::all_read))
+    return false;
+
+  {
+    llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS.write(reinterpret_cast<const char *>(Data.data()), Data.size());
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      llvm::sys::fs::remove(TmpPath);
+      return false;
+    }
+  }
+
+  if (llvm::sys::fs::rename(TmpPath, Path)) {
+    llvm::sys::fs::remove(TmpPath);
+    return false;
+  }
+  return true;
+}
+
+// looks up an object compiled from the same bitcode in Dir before it runs
+// the backend, and publishes what it compiles. the key is taken before
+// codegen, which changes the module.
+class CachingCompiler : public llvm::orc::IRCompileLayer::IRCompiler {
+  std::string Dir;
+  llvm::orc::ConcurrentIRCompiler Compile;
+
+public:
+  CachingCompiler(llvm::orc::JITTargetMachineBuilder JTMB, llvm::StringRef Dir)
+      : IRCompiler(
+            llvm::orc::irManglingOptionsFromTargetOptions(JTMB.getOptions())),
+        Dir(Dir.str()), Compile(std::move(JTMB)) {}
+
+  llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+  operator()(llvm::Module &M) override {
+    // the bitcode carries the triple, data layout, function attributes
+    // (cpu and features) and the producing llvm version
+    llvm::SmallVector<char, 0> Bitcode;
+    llvm::raw_svector_ostream OS(Bitcode);
+    llvm::WriteBitcodeToFile(M, OS);
+
+    std::string Path = getCachePath(
+        Dir, "llvmcache-obj-",
+        llvm::ArrayRef<uint8_t>(
+            reinterpret_cast<const uint8_t *>(Bitcode.data()), Bitcode.size()),
+        ".o");
+
+    auto Cached = llvm::MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+    if (Cached)
+      return std::move(*Cached);
+
+    auto Obj = Compile(M);
+    if (Obj) {
+      publish(Dir, Path,
+              llvm::ArrayRef<uint8_t>(
+                  reinterpret_cast<const uint8_t *>((*Obj)->getBufferStart()),
+                  (*Obj)->getBufferSize()));
+    }
+    return Obj;
+  }
+};
+
+// replaces the private pages [Base, Base + Size) with a read-only mapping of
+// the cache file holding the same bytes, creating the file if needed.
+bool shareSegment(llvm::StringRef Dir, uint8_t *Base, size_t Size, int Prot) {
+  llvm::ArrayRef<uint8_t> Data(Base, Size);
+  std::string Path = getCachePath(Dir, "llvmcache-seg-", Data, ".bin");
+
+  int FD = ::open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (FD < 0) {
+    if (!publish(Dir, Path, Data))
+      return false;
+    FD = ::open(Path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (FD < 0)
+      return false;
+  }
+
+  // code runs from the file, so it has to be one nobody can write to, as
+  // publish leaves it
+  struct stat St;
+  if (fstat(FD, &St) || static_cast<size_t>(St.st_size) != Size ||
+      (St.st_mode & (S_IWUSR | S_IWGRP | S_IWOTH))) {
+    close(FD);
+    return false;
+  }
+
+  // probe first: a noexec cache directory or a hash collision must leave the
+  // private pages in place. a private mapping still shares the clean pages
+  // of the page cache, but is not a window onto later writes to the file.
+  bool Shared = false;
+  void *Probe = mmap(nullptr, Size, Prot, MAP_PRIVATE, FD, 0);
+  if (Probe != MAP_FAILED) {
+    Shared = memcmp(Probe, Base, Size) == 0;
+    munmap(Probe, Size);
+  }
+
+  if (Shared)
+    Shared =
+        mmap(Base, Size, Prot, MAP_PRIVATE | MAP_FIXED, FD, 0) != MAP_FAILED;
+
+  close(FD);
+  return Shared;
+}
+
+class SharedCodeMemoryManager : public llvm::RTDyldMemoryManager {
+  struct Segment {
+    uint8_t *Base = nullptr;
+    size_t Size = 0;
+    size_t Used = 0;
+
+    uint8_t *allocate(uintptr_t Bytes, unsigned Alignment) {
+      size_t Start = llvm::alignTo(Used, Alignment ? Alignment : 1);
+      if (!Base || Start + Bytes > Size)
+        return nullptr;
+      Used = Start + Bytes;
+      return Base + Start;
+    }
+  };
+
+  std::string Dir;
+  size_t PageSize;
+  uint8_t *Region = nullptr;
+  size_t RegionSize = 0;
+  Segment Code;
+  Segment ROData;
+  Segment RWData;
+
+  // sections that do not fit the reservation, never shared
+  llvm::SectionMemoryManager Fallback;
+
+public:
+  SharedCodeMemoryManager(llvm::StringRef Dir)
+      : Dir(Dir.str()), PageSize(llvm::sys::Process::getPageSizeEstimate()) {}
+
+  ~SharedCodeMemoryManager() override {
+    if (Region)
+      munmap(Region, RegionSize);
+  }
+
+  bool needsToReserveAllocationSpace() override { return true; }
+
+  void reserveAllocationSpace(uintptr_t CodeSize, uint32_t CodeAlign,
+                              uintptr_t RODataSize, uint32_t RODataAlign,
+                              uintptr_t RWDataSize,
+                              uint32_t RWDataAlign) override {
+    size_t CodeBytes = llvm::alignTo(CodeSize, PageSize);
+    size_t ROBytes = llvm::alignTo(RODataSize, PageSize);
+    // the got entries behind x86-64 plt stubs are not part of the estimate.
+    // read-write data comes last, so it can grow into untouched slack
+    // without moving the segments that are shared.
+    size_t RWBytes = llvm::alignTo(RWDataSize + CodeSize + 64 * 1024, PageSize);
+
+    size_t Size = CodeBytes + ROBytes + RWBytes;
+    void *P = mmap(nullptr, Size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (P == MAP_FAILED)
+      return;
+
+    Region = static_cast<uint8_t *>(P);
+    RegionSize = Size;
+    Code.Base = Region;
+    Code.Size = CodeBytes;
+    ROData.Base = Region + CodeBytes;
+    ROData.Size = ROBytes;
+    RWData.Base = Region + CodeBytes + ROBytes;
+    RWData.Size = RWBytes;
+  }
+
+  uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID,
+                               llvm::StringRef SectionName) override {
+    if (uint8_t *P = Code.allocate(Size, Alignment))
+      return P;
+    return Fallback.allocateCodeSection(Size, Alignment, SectionID,
+                                        SectionName);
+  }
+
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID, llvm::StringRef SectionName,
+                               bool IsReadOnly) override {
+    Segment &S = IsReadOnly ? ROData : RWData;
+    if (uint8_t *P = S.allocate(Size, Alignment))
+      return P;
+    return Fallback.allocateDataSection(Size, Alignment, SectionID,
+                                        SectionName, IsReadOnly);
+  }
+
+  bool finalizeMemory(std::string *ErrMsg) override {
+    if (Code.Used) {
+      if (mprotect(Code.Base, Code.Size, PROT_READ | PROT_EXEC)) {
+        if (ErrMsg)
+          *ErrMsg = strerror(errno);
+        return true;
+      }
+      llvm::sys::Memory::InvalidateInstructionCache(Code.Base, Code.Used);
+      shareSegment(Dir, Code.Base, Code.Size, PROT_READ | PROT_EXEC);
+    }
+
+    if (ROData.Used) {
+      if (mprotect(ROData.Base, ROData.Size, PROT_READ)) {
+        if (ErrMsg)
+          *ErrMsg = strerror(errno);
+        return true;
+      }
+      shareSegment(Dir, ROData.Base, ROData.Size, PROT_READ);
+    }
+
+    return Fallback.finalizeMemory(ErrMsg);
+  }
+};
+
+} // anonymous namespace
+
+std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>
+createCachingCompiler(llvm::orc::JITTargetMachineBuilder JTMB,
+                      llvm::StringRef Dir) {
+  return std::make_unique<CachingCompiler>(std::move(JTMB), Dir);
+}
+
+llvm::Error pruneCodeCache(llvm::StringRef Dir, llvm::StringRef Policy) {
+  auto ParsedPolicy = llvm::parseCachePruningPolicy(Policy);
+  if (!ParsedPolicy)
+    return ParsedPolicy.takeError();
+  llvm::pruneCache(Dir, *ParsedPolicy);
+  return llvm::Error::success();
+}
+
+std::unique_ptr<llvm::RuntimeDyld::MemoryManager>
+createSharedCodeMemoryManager(llvm::StringRef Dir) {
+  return std::make_unique<SharedCodeMemoryManager>(Dir);
+}
+
+} // namespace clang
@@ -0,0 +1,36 @@
+#ifndef LLVM_CLANG_TOOLS_CLANG_CCINT_CODE_CACHE_H
+#define LLVM_CLANG_TOOLS_CLANG_CCINT_CODE_CACHE_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/RuntimeDyld.h"
+#include "llvm/Support/Error.h"
+
+#include <memory>
+
+namespace clang {
+
+// a compiler that caches objects in Dir, keyed by a hash of the module's
+// bitcode, so that processes jitting the same script skip the backend.
+std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>
+createCachingCompiler(llvm::orc::JITTargetMachineBuilder JTMB,
+                      llvm::StringRef Dir);
+
+// a memory manager that lays out each object's code, read-only data and
+// read-write data back to back in one region. for position-independent
+// objects the relocated code and read-only pages are then identical in
+// every process, so they are published to Dir under a hash of their content
+// and mapped from there, shared through the page cache. pages that differ
+// stay private.
+std::unique_ptr<llvm::RuntimeDyld::MemoryManager>
+createSharedCodeMemoryManager(llvm::StringRef Dir);
+
+// removes cache files of Dir by age and total size as Policy, in the syntax
+// of llvm::parseCachePruningPolicy, allows. files that are mapped stay valid
+// in the processes mapping them.
+llvm::Error pruneCodeCache(llvm::StringRef Dir, llvm::StringRef Policy);
+
+} // namespace clang
+
+#endif // LLVM_CLANG_TOOLS_CLANG_CCINT_CODE_CACHE_H
@@ -1,4 +1,7 @@
+#include "Allocator.h"
+#include "Benchmark.h"
 #include "Interpreter.h"
+#include "RemoteExecutor.h"
 #include "Utils.h"
 #include "clang/Basic/Diagnostic.h"
 #include "clang/Frontend/CompilerInstance.h"
@@ -31,14 +34,80 @@ static llvm::cl::list<std::string>
 static llvm::cl::list<std::string> Libs("L", llvm::cl::desc("load given libs"),
                                         llvm::cl::ZeroOrMore);
 
-static llvm::cl::opt<std::string> inputFile(llvm::cl::Positional,
-                                            llvm::cl::desc("<input file>"),
-                                            llvm::cl::Required);
-
-int main(int argc, const char **argv) {
-  llvm::cl::ParseCommandLineOptions(argc, argv);
-
-  auto CI = ExitOnErr(clang::Interpreter::CreateCI());
+static llvm::cl::opt<unsigned>
+    OptLevel("O", llvm::cl::desc("optimization level of the script, 0-3"),
+             llvm::cl::Prefix, llvm::cl::init(0));
+
+static llvm::cl::opt<bool> WholeProgram(
+    "whole-program",
+    llvm::cl::desc("internalize everything but ccint_main, drop dead code and "
+                   "optimize the script as a whole before jitting"));
+
+static llvm::cl::opt<unsigned> JitThreads(
+    "jit-threads",
+    llvm::cl::desc("split the module and compile it on N threads up front"),
+    llvm::cl::init(0));
+
+static llvm::cl::opt<clang::AllocatorKind> Allocator(
+    "allocator", llvm::cl::desc("allocator used by jit'd code"),
+    llvm::cl::values(
+        clEnumValN(clang::AllocatorKind::System, "system", "host libc malloc"),
+        clEnumValN(clang::AllocatorKind::Pool, "pool",
+                   "thread-caching size-class pools"),
+        clEnumValN(clang::AllocatorKind::Arena, "arena",
+                   "bump allocation, memory is released at exit")),
+    llvm::cl::init(clang::AllocatorKind::System));
+
+static llvm::cl::opt<bool> AllocStats(
+    "alloc-stats",
+    llvm::cl::desc("print allocation statistics of jit'd code at exit"));
+
+static llvm::cl::opt<std::string> CodeCache(
+    "code-cache",
+    llvm::cl::desc("cache compiled code in <dir> and share the code pages "
+                   "between processes running the same script"),
+    llvm::cl::value_desc("dir"));
+
+static llvm::cl::opt<std::string> CodeCachePolicy(
+    "code-cache-policy",
+    llvm::cl::desc("when and down to what --code-cache is pruned, as "
+                   "prune_interval=<dur>:prune_after=<dur>:cache_size_bytes="
+                   "<size>"),
+    llvm::cl::init("prune_after=168h:cache_size_bytes=1g"));
+
+static llvm::cl::opt<bool> OpenMP(
+    "fopenmp",
+    llvm::cl::desc("enable openmp in scripts and load the openmp runtime"));
+
+static llvm::cl::opt<unsigned>
+    BenchRuns("bench",
+              llvm::cl::desc("compile once, then call ccint_main N times and "
+                             "report timing statistics"),
+              llvm::cl::init(0));
+
+static llvm::cl::opt<unsigned>
+    BenchWarmup("bench-warmup",
+                llvm::cl::desc("untimed warmup runs before --bench"),
+                llvm::cl::init(1));
+
+static llvm::cl::opt<int>
+    BenchCPU("bench-cpu", llvm::cl::desc("pin --bench runs to the given cpu"),
+             llvm::cl::init(-1));
+
+static llvm::cl::opt<std::string> OOPExecutor(
+    "oop-executor",
+    llvm::cl::desc("run jit'd code in a separate executor process, "
+                   "llvm-jitlink-executor next to ccint by default"),
+    llvm::cl::value_desc("path"), llvm::cl::ValueOptional);
+
+static llvm::cl::list<std::string> inputFiles(llvm::cl::Positional,
+                                              llvm::cl::desc("<input files>"),
+                                              llvm::cl::OneOrMore);
+
+static std::unique_ptr<clang::Interpreter>
+createInterpreter(llvm::ArrayRef<const char *> ExtraArgs,
+                  const std::string &ExecutorPath) {
+  auto CI = ExitOnErr(clang::Interpreter::CreateCI(ExtraArgs));
 
   llvm::install_fatal_error_handler(LLVMErrorHandler,
                                     static_cast<void *>(&CI->getDiagnostics()));
@@ -47,6 +116,14 @@ int main(int argc, const char **argv) {
   auto Interp = ExitOnErr(clang::Interpreter::create(std::move(CI)));
 
   Interp->enablerWrapInput(wrap);
+  Interp->enableWholeProgram(WholeProgram);
+  Interp->getJITOptions().NumCompileThreads = JitThreads;
+  Interp->getJITOptions().Allocator = Allocator;
+  Interp->getJITOptions().AllocatorStats = AllocStats;
+  Interp->getJITOptions().CodeCacheDir = CodeCache;
+  Interp->getJITOptions().CodeCachePolicy = CodeCachePolicy;
+  Interp->getJITOptions().OpenMP = OpenMP;
+  Interp->getJITOptions().ExecutorPath = ExecutorPath;
 
   Interp->AddIncludePath(".");
   for (size_t i = 0; i < IncludePaths.size(); i++) {
@@ -61,12 +138,85 @@ int main(int argc, const char **argv) {
     }
   }
 
-  if (auto Err = Interp->ParseAndExecute(inputFile)) {
+  return Interp;
+}
+
+// in-process, every script gets its own compiler instance and jit. errors
+// are reported and the next script runs.
+static void runScript(const std::string &inputFile,
+                      llvm::ArrayRef<const char *> ExtraArgs,
+                      const std::string &ExecutorPath) {
+  auto Interp = createInterpreter(ExtraArgs, ExecutorPath);
+
+  if (BenchRuns) {
+    clang::BenchOptions Opts;
+    Opts.Runs = BenchRuns;
+    Opts.Warmup = BenchWarmup;
+    Opts.CPU = BenchCPU;
+    if (auto Err = Interp->Benchmark(inputFile, Opts)) {
+      llvm::logAllUnhandledErrors(std::move(Err), llvm::errs(), "error: ");
+    }
+  } else if (auto Err = Interp->ParseAndExecute(inputFile)) {
     llvm::logAllUnhandledErrors(std::move(Err), llvm::errs(), "error: ");
-    return 0;
   }
 
+  // shuts the executor down before the handler goes away
+  Interp.reset();
   llvm::remove_fatal_error_handler();
+}
+
+// out-of-process, one compiler instance and jit serve all scripts, and a
+// script is compiled while the one before it runs in the executor.
+static void runScripts(llvm::ArrayRef<const char *> ExtraArgs,
+                       const std::string &ExecutorPath) {
+  auto Interp = createInterpreter(ExtraArgs, ExecutorPath);
+
+  Interp->ExecuteFiles(inputFiles, [](llvm::StringRef, llvm::Error Err) {
+    if (Err) {
+      llvm::logAllUnhandledErrors(std::move(Err), llvm::errs(), "error: ");
+    }
+  });
+
+  Interp.reset();
+  llvm::remove_fatal_error_handler();
+}
+
+int main(int argc, const char **argv) {
+  llvm::cl::ParseCommandLineOptions(argc, argv);
+
+  // the frontend runs the llvm pipeline on the whole module, before
+  // --jit-threads splits it. -O0 marks every function optnone/noinline,
+  // which defeats inlining.
+  unsigned Level = OptLevel;
+  if (WholeProgram && Level < 2) {
+    Level = 2;
+  }
+  std::string OptArg = "-O" + std::to_string(Level);
+  std::vector<const char *> ExtraArgs = {OptArg.c_str()};
+  if (OpenMP) {
+    ExtraArgs.push_back("-fopenmp");
+    // runtimedyld cannot allocate tls sections, so threadprivate variables
+    // go through __kmpc_threadprivate_cached instead
+    ExtraArgs.push_back("-fnoopenmp-use-tls");
+  }
+
+  std::string ExecutorPath = OOPExecutor;
+  if (OOPExecutor.getNumOccurrences() && ExecutorPath.empty()) {
+    ExecutorPath = clang::getDefaultExecutorPath();
+  }
+
+  if (!ExecutorPath.empty() && !BenchRuns) {
+    runScripts(ExtraArgs, ExecutorPath);
+  } else {
+    for (const std::string &inputFile : inputFiles) {
+      runScript(inputFile, ExtraArgs, ExecutorPath);
+    }
+  }
+
+  if (AllocStats) {
+    clang::printAllocatorStats(llvm::errs());
+  }
+
   llvm::llvm_shutdown();
   return 0;
 }
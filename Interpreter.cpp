@@ -1,6 +1,8 @@
 #include "Interpreter.h"
+#include "Benchmark.h"
 #include "CCIntJIT.h"
 #include "CCIntParser.h"
+#include "Runtime.h"
 
 #include "clang/AST/ASTContext.h"
 #include "clang/Basic/TargetInfo.h"
@@ -21,7 +23,10 @@
 
 #include "llvm/IR/Module.h"
 #include "llvm/Support/Errc.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/Host.h"
+#include <chrono>
+#include <future>
 #include <memory>
 
 #include <clang/AST/DeclVisitor.h>
@@ -117,7 +122,8 @@ CreateCIInternal(const llvm::opt::ArgStringList &Argv) {
 }
 
 } // anonymous namespace
-llvm::Expected<std::unique_ptr<CompilerInstance>> Interpreter::CreateCI() {
+llvm::Expected<std::unique_ptr<CompilerInstance>>
+Interpreter::CreateCI(llvm::ArrayRef<const char *> ExtraArgs) {
   std::vector<const char *> ClangArgv;
   std::string MainExecutableName =
       llvm::sys::fs::getMainExecutable(nullptr, nullptr);
@@ -128,6 +134,7 @@ llvm::Expected<std::unique_ptr<CompilerInstance>> Interpreter::CreateCI() {
   ClangArgv.push_back("-x");
   ClangArgv.push_back("c++");
   ClangArgv.push_back("-D_GLIBCXX_USE_CXX11_ABI=0");
+  ClangArgv.insert(ClangArgv.end(), ExtraArgs.begin(), ExtraArgs.end());
 
   ClangArgv.push_back("<input>");
 
@@ -153,10 +160,12 @@ llvm::Expected<std::unique_ptr<CompilerInstance>> Interpreter::CreateCI() {
 }
 
 Interpreter::Interpreter(std::unique_ptr<CompilerInstance> CI, llvm::Error &Err)
-    : m_WrapInput(false) {
+    : m_WrapInput(false), m_WholeProgram(false) {
   llvm::ErrorAsOutParameter EAO(&Err);
   auto LLVMCtx = std::make_unique<llvm::LLVMContext>();
   TSCtx = std::make_unique<llvm::orc::ThreadSafeContext>(std::move(LLVMCtx));
+  Inputs = std::make_unique<InputBuffers>();
+  JITOpts.Inputs = Inputs.get();
   Parser =
       std::make_unique<CCIntParser>(std::move(CI), *TSCtx->getContext(), Err);
 }
@@ -170,6 +179,8 @@ Interpreter::create(std::unique_ptr<CompilerInstance> CI) {
       std::unique_ptr<Interpreter>(new Interpreter(std::move(CI), Err));
   if (Err)
     return std::move(Err);
+
+  Interp->AddIncludePath(getRuntimeIncludePath());
   return std::move(Interp);
 }
 
@@ -183,46 +194,218 @@ llvm::Error Interpreter::Parse(llvm::StringRef FileName) {
   return Parser->Parse(FileName, isWrapInputEnabled());
 }
 
+llvm::Error Interpreter::createExecutor() {
+  const clang::TargetInfo &TI = getCompilerInstance()->getTarget();
+
+  llvm::Error Err = llvm::Error::success();
+  Executor = std::make_unique<CCIntJIT>(*TSCtx, Err, TI, JITOpts);
+
+  if (Err)
+    return Err;
+
+  for (auto &Path : StaticLibVec) {
+    if (Err = Executor->AddStaticLib(Path)) {
+      return Err;
+    }
+  }
+
+  for (auto &Path : DynamicLibVec) {
+    if (Err = Executor->AddDynamicLib(Path)) {
+      return Err;
+    }
+  }
+
+  return llvm::Error::success();
+}
+
+llvm::Error Interpreter::prepareModule(llvm::Module &M) {
+  IRStats = getModuleStats(M);
+
+  if (isWholeProgramEnabled()) {
+    const clang::TargetInfo &TI = getCompilerInstance()->getTarget();
+    auto Begin = std::chrono::steady_clock::now();
+    if (auto Err = internalizeAndOptimize(M, Parser->GetMangledName(), TI)) {
+      return Err;
+    }
+    OptimizeTime = std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - Begin)
+                       .count();
+    OptimizedIRStats = getModuleStats(M);
+  }
+
+  return llvm::Error::success();
+}
+
+llvm::Error Interpreter::Compile() {
+  if (Executor) {
+    return llvm::Error::success();
+  }
+
+  if (auto Err = createExecutor()) {
+    return Err;
+  }
+
+  std::unique_ptr<llvm::Module> M = getModule();
+  if (auto Err = prepareModule(*M)) {
+    return Err;
+  }
+
+  if (auto Err = Executor->addModule(std::move(M))) {
+    return Err;
+  }
+
+  return Executor->runCtors();
+}
+
 llvm::Error Interpreter::Execute() {
+  if (auto Err = Compile()) {
+    return Err;
+  }
+
+  return Executor->callFunction(Parser->GetMangledName());
+}
+
+llvm::Expected<CompiledScript> Interpreter::CompileScript() {
   if (!Executor) {
-    const clang::TargetInfo &TI = getCompilerInstance()->getTarget();
+    if (auto Err = createExecutor()) {
+      Executor.reset();
+      return std::move(Err);
+    }
+  }
 
-    llvm::Error Err = llvm::Error::success();
-    Executor = std::make_unique<CCIntJIT>(*TSCtx, Err, TI);
+  std::unique_ptr<llvm::Module> M = getModule();
+  if (auto Err = prepareModule(*M)) {
+    return std::move(Err);
+  }
 
-    if (Err)
-      return Err;
+  auto JD = Executor->createScript();
+  if (!JD) {
+    return JD.takeError();
+  }
 
-    for (auto &Path : StaticLibVec) {
-      if (Err = Executor->AddStaticLib(Path)) {
-        return Err;
-      }
+  if (auto Err = Executor->addModule(*JD, std::move(M))) {
+    // the script never ran, only its dylib is left to drop
+    llvm::consumeError(Executor->dropScript(*JD));
+    return std::move(Err);
+  }
+
+  return CompiledScript{&*JD, Parser->GetMangledName().str()};
+}
+
+llvm::Error Interpreter::RunScript(const CompiledScript &S) {
+  llvm::Error Err = Executor->runCtors(*S.JD);
+  if (!Err) {
+    Err = Executor->callFunction(*S.JD, S.Entry);
+  }
+  return llvm::joinErrors(std::move(Err), Executor->removeScript(*S.JD));
+}
+
+void Interpreter::ExecuteFiles(
+    llvm::ArrayRef<std::string> FileNames,
+    llvm::function_ref<void(llvm::StringRef, llvm::Error)> Report) {
+  auto ParseAndCompile =
+      [&](llvm::StringRef FileName) -> llvm::Expected<CompiledScript> {
+    if (auto Err = Parse(FileName)) {
+      return std::move(Err);
     }
+    return CompileScript();
+  };
 
-    for (auto &Path : DynamicLibVec) {
-      if (Err = Executor->AddDynamicLib(Path)) {
-        return Err;
+  // the script running in the executor, if any. everything but the calls
+  // into it stays on this thread.
+  std::future<llvm::Error> Running;
+  llvm::StringRef RunningFile;
+
+  for (const std::string &FileName : FileNames) {
+    auto Script = ParseAndCompile(FileName);
+
+    if (Running.valid()) {
+      Report(RunningFile, Running.get());
+
+      // the jit went down with the executor, which the script compiled
+      // meanwhile was linked against
+      if (!Executor->isAlive()) {
+        if (!Script) {
+          llvm::consumeError(Script.takeError());
+        }
+        Executor.reset();
+        Script = ParseAndCompile(FileName);
       }
     }
 
-    if (Err = Executor->addModule(std::move(getModule()))) {
-      return Err;
+    if (!Script) {
+      Report(FileName, Script.takeError());
+      continue;
     }
 
-    if (Err = Executor->runCtors()) {
-      return Err;
+    if (!Executor->isOutOfProcess()) {
+      Report(FileName, RunScript(*Script));
+      continue;
     }
+
+    Running = std::async(std::launch::async,
+                         [this, S = *Script] { return RunScript(S); });
+    RunningFile = FileName;
+  }
+
+  if (Running.valid()) {
+    Report(RunningFile, Running.get());
+  }
+}
+
+llvm::Error Interpreter::Benchmark(llvm::StringRef FileName,
+                                   const BenchOptions &Opts) {
+  using Clock = std::chrono::steady_clock;
+  auto ms = [](Clock::duration D) {
+    return std::chrono::duration<double, std::milli>(D).count();
+  };
+
+  // the timed calls are made directly
+  if (!JITOpts.ExecutorPath.empty()) {
+    return llvm::createStringError(llvm::errc::not_supported,
+                                   "--bench runs in-process only");
   }
 
+  auto ParseBegin = Clock::now();
+  if (auto Err = Parse(FileName)) {
+    return Err;
+  }
+
+  // the jit materializes lazily, so the lookup is part of the compile time
+  auto JitBegin = Clock::now();
+  if (auto Err = Compile()) {
+    return Err;
+  }
   auto Symbol = getSymbolAddress();
   if (!Symbol) {
     return Symbol.takeError();
   }
+  auto JitEnd = Clock::now();
+
+  llvm::outs() << llvm::format("parse:  %12.3f ms\n",
+                               ms(JitBegin - ParseBegin));
+  llvm::outs() << llvm::format("jit:    %12.3f ms\n", ms(JitEnd - JitBegin));
+  if (isWholeProgramEnabled()) {
+    llvm::outs() << llvm::format("  whole-program optimization: %.3f ms\n",
+                                 OptimizeTime);
+  }
 
-  int (*fp)() = reinterpret_cast<int (*)()>(Symbol.get());
-  int ret = fp();
+  auto PrintIR = [](const char *Label, const ModuleStats &Stats) {
+    llvm::outs() << llvm::format("%-8s%zu functions, %zu globals, %zu "
+                                 "instructions\n",
+                                 Label, Stats.Functions, Stats.Globals,
+                                 Stats.Instructions);
+  };
+  PrintIR("ir:", IRStats);
+  if (isWholeProgramEnabled()) {
+    PrintIR("ir opt:", OptimizedIRStats);
+  }
+  llvm::outs() << "code:   " << Executor->getCodeSize() << " bytes\n";
+  // taken before the runs, so it covers the frontend and the jit only
+  llvm::outs() << "rss:    " << getPeakRSS() / 1024 << " KiB peak\n";
 
-  return llvm::Error::success();
+  void (*fp)() = reinterpret_cast<void (*)()>(Symbol.get());
+  return runBenchmark(fp, Opts, llvm::outs());
 }
 
 llvm::Expected<llvm::JITTargetAddress> Interpreter::getSymbolAddress() const {
@@ -265,6 +448,19 @@ void Interpreter::AddDynamicLib(llvm::StringRef Path) {
   DynamicLibVec.push_back(Path.str());
 }
 
+llvm::Error Interpreter::AddInputBuffer(llvm::StringRef Name,
+                                        llvm::StringRef Data) {
+  if (!JITOpts.ExecutorPath.empty()) {
+    return llvm::createStringError(llvm::errc::not_supported,
+                                   "input buffers need in-process execution");
+  }
+  return Inputs->add(Name, Data);
+}
+
+bool Interpreter::RemoveInputBuffer(llvm::StringRef Name) {
+  return Inputs->remove(Name);
+}
+
 void Interpreter::AddHeaderPath(llvm::StringRef Path) {
   HeaderPathVec.push_back(Path.str());
 }
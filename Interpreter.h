@@ -1,18 +1,25 @@
 #ifndef LLVM_CLANG_TOOLS_CLANG_CCINT_INTERPRETER_H
 #define LLVM_CLANG_TOOLS_CLANG_CCINT_INTERPRETER_H
 
+#include "CCIntJIT.h"
+#include "Optimizer.h"
+
 #include "clang/AST/GlobalDecl.h"
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
 #include "llvm/Support/Error.h"
 
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace llvm {
 class Module;
 
 namespace orc {
+class JITDylib;
 class LLJIT;
 class ThreadSafeContext;
 } // namespace orc
@@ -22,22 +29,45 @@ namespace clang {
 
 class CompilerInstance;
 class CCIntJIT;
+struct BenchOptions;
 class CCIntParser;
+class InputBuffers;
+
+// a script compiled into a dylib of its own, see CCIntJIT::createScript
+struct CompiledScript {
+  llvm::orc::JITDylib *JD = nullptr;
+  std::string Entry;
+};
 
 class Interpreter {
   bool m_WrapInput;
+  bool m_WholeProgram;
   std::vector<std::string> StaticLibVec;
   std::vector<std::string> DynamicLibVec;
   std::vector<std::string> HeaderPathVec;
+  CCIntJITOptions JITOpts;
+
+  // filled in by Compile, reported by Benchmark
+  ModuleStats IRStats;
+  ModuleStats OptimizedIRStats;
+  double OptimizeTime = 0;
 
   std::unique_ptr<llvm::orc::ThreadSafeContext> TSCtx;
   std::unique_ptr<CCIntParser> Parser;
+  // declared before Executor, jit'd code may use the buffers until it is
+  // gone
+  std::unique_ptr<InputBuffers> Inputs;
   std::unique_ptr<CCIntJIT> Executor;
   Interpreter(std::unique_ptr<CompilerInstance> CI, llvm::Error &Err);
 
+  llvm::Error createExecutor();
+  // whole-program optimization if enabled, and the stats Benchmark reports
+  llvm::Error prepareModule(llvm::Module &M);
+
 public:
   ~Interpreter();
-  static llvm::Expected<std::unique_ptr<CompilerInstance>> CreateCI();
+  static llvm::Expected<std::unique_ptr<CompilerInstance>>
+  CreateCI(llvm::ArrayRef<const char *> ExtraArgs = {});
   static llvm::Expected<std::unique_ptr<Interpreter>>
   create(std::unique_ptr<CompilerInstance> CI);
   CompilerInstance *getCompilerInstance();
@@ -50,10 +80,40 @@ public:
   void AddDynamicLib(llvm::StringRef Path);
   void AddHeaderPath(llvm::StringRef Path);
 
+  // hands Data to the scripts of this interpreter through
+  // ccint_map_input(Name) without copying. Data must stay alive until Name
+  // is removed or the interpreter is gone. fails out-of-process, and when
+  // too many interpreters with buffers are alive.
+  llvm::Error AddInputBuffer(llvm::StringRef Name, llvm::StringRef Data);
+
+  // after this, later ccint_map_input(Name) calls no longer see the buffer
+  // and its memory may be freed once no script holds a view of it. returns
+  // false if Name was not registered.
+  bool RemoveInputBuffer(llvm::StringRef Name);
+
   llvm::Error Parse(llvm::StringRef FileName);
 
+  llvm::Error Compile();
   llvm::Error Execute();
 
+  // compiles the parsed script into a dylib of its own, next to those of
+  // earlier scripts
+  llvm::Expected<CompiledScript> CompileScript();
+
+  // runs the constructors and the entry of S, then its exit handlers, and
+  // drops its code
+  llvm::Error RunScript(const CompiledScript &S);
+
+  // runs every file as a script of its own with one compiler and one jit.
+  // out-of-process, a script runs in the executor while the next one is
+  // parsed and compiled, and after a crash the executor is started again.
+  // Report gets the outcome of every file, in order.
+  void ExecuteFiles(
+      llvm::ArrayRef<std::string> FileNames,
+      llvm::function_ref<void(llvm::StringRef, llvm::Error)> Report);
+
+  llvm::Error Benchmark(llvm::StringRef FileName, const BenchOptions &Opts);
+
   llvm::Error ParseAndExecute(llvm::StringRef FileName) {
     if (auto Err = Parse(FileName)) {
       return Err;
@@ -61,9 +121,14 @@ public:
     return Execute();
   }
 
+  CCIntJITOptions &getJITOptions() { return JITOpts; }
+
   bool isWrapInputEnabled() const { return m_WrapInput; }
   void enablerWrapInput(bool wrap = true) { m_WrapInput = wrap; }
 
+  bool isWholeProgramEnabled() const { return m_WholeProgram; }
+  void enableWholeProgram(bool enable = true) { m_WholeProgram = enable; }
+
   llvm::Expected<llvm::JITTargetAddress> getSymbolAddress() const;
 };
 } // namespace clang
@@ -0,0 +1,69 @@
+#include "Optimizer.h"
+
+#include "clang/Basic/TargetInfo.h"
+#include "clang/Basic/TargetOptions.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/IPO/GlobalDCE.h"
+#include "llvm/Transforms/IPO/Internalize.h"
+
+namespace clang {
+
+ModuleStats getModuleStats(const llvm::Module &M) {
+  ModuleStats Stats;
+  for (const llvm::Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    Stats.Functions++;
+    Stats.Instructions += F.getInstructionCount();
+  }
+
+  for (const llvm::GlobalVariable &GV : M.globals()) {
+    if (!GV.isDeclaration())
+      Stats.Globals++;
+  }
+  return Stats;
+}
+
+llvm::Error internalizeAndOptimize(llvm::Module &M, llvm::StringRef EntryPoint,
+                                   const clang::TargetInfo &TI) {
+  if (!M.getFunction(EntryPoint)) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   "entry point %s not found",
+                                   EntryPoint.str().c_str());
+  }
+
+  // the cost models need the real target, the same one the jit compiles for
+  auto JTMB = llvm::orc::JITTargetMachineBuilder(TI.getTriple());
+  JTMB.addFeatures(TI.getTargetOpts().Features);
+  auto TM = JTMB.createTargetMachine();
+  if (!TM)
+    return TM.takeError();
+
+  llvm::LoopAnalysisManager LAM;
+  llvm::FunctionAnalysisManager FAM;
+  llvm::CGSCCAnalysisManager CGAM;
+  llvm::ModuleAnalysisManager MAM;
+
+  llvm::PassBuilder PB(TM->get());
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  // llvm.used and the ctor/dtor arrays keep static initializers alive
+  llvm::ModulePassManager MPM;
+  MPM.addPass(llvm::InternalizePass(
+      [&](const llvm::GlobalValue &GV) { return GV.getName() == EntryPoint; }));
+  MPM.addPass(llvm::GlobalDCEPass());
+  MPM.addPass(PB.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O3));
+  MPM.run(M, MAM);
+
+  return llvm::Error::success();
+}
+
+} // namespace clang
@@ -0,0 +1,34 @@
+#ifndef LLVM_CLANG_TOOLS_CLANG_CCINT_OPTIMIZER_H
+#define LLVM_CLANG_TOOLS_CLANG_CCINT_OPTIMIZER_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+
+#include <cstddef>
+
+namespace llvm {
+class Module;
+} // namespace llvm
+
+namespace clang {
+
+class TargetInfo;
+
+struct ModuleStats {
+  size_t Functions = 0; // defined functions
+  size_t Globals = 0;   // defined global variables
+  size_t Instructions = 0;
+};
+
+ModuleStats getModuleStats(const llvm::Module &M);
+
+// treats M as the whole program with EntryPoint as its only root: every
+// other definition is internalized, unreachable ones are dropped, and the
+// rest goes through the O3 module pipeline so that it can be inlined and
+// constant-propagated across what used to be external boundaries.
+llvm::Error internalizeAndOptimize(llvm::Module &M, llvm::StringRef EntryPoint,
+                                   const clang::TargetInfo &TI);
+
+} // namespace clang
+
+#endif // LLVM_CLANG_TOOLS_CLANG_CCINT_OPTIMIZER_H
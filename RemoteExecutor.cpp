@@ -0,0 +1,484 @@
+#include "RemoteExecutor.h"
+
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/Shared/SimpleRemoteEPCUtils.h"
+#include "llvm/ExecutionEngine/Orc/SimpleRemoteEPC.h"
+#include "llvm/ExecutionEngine/Orc/TaskDispatch.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace clang {
+
+namespace {
+
+llvm::Error errnoError(const char *What) {
+  std::error_code EC(errno, std::generic_category());
+  return llvm::createStringError(EC, "%s: %s", What, EC.message().c_str());
+}
+
+// the controller side of the connection to an executor, speaking the wire
+// format of FDSimpleRemoteEPCTransport, which the executor uses. it writes
+// with send and MSG_NOSIGNAL: writing to an executor that crashed fails
+// with EPIPE instead of raising SIGPIPE, and the signal handling of the
+// process is left alone.
+class SocketEPCTransport : public llvm::orc::SimpleRemoteEPCTransport {
+  using Opcode = llvm::orc::SimpleRemoteEPCOpcode;
+
+  // message size, opcode, sequence number and tag address, each a little
+  // endian 64-bit word
+  static constexpr size_t HeaderSize = 4 * sizeof(uint64_t);
+
+  llvm::orc::SimpleRemoteEPCTransportClient &C;
+  int FD;
+  std::mutex M;
+  std::thread ListenerThread;
+  std::atomic<bool> Disconnected{false};
+
+  SocketEPCTransport(llvm::orc::SimpleRemoteEPCTransportClient &C, int FD)
+      : C(C), FD(FD) {}
+
+  llvm::Error readBytes(char *Dst, size_t Size, bool *IsEOF = nullptr) {
+    size_t Done = 0;
+    while (Done < Size) {
+      ssize_t N = read(FD, Dst + Done, Size - Done);
+      if (N < 0) {
+        if (errno == EINTR)
+          continue;
+        return errnoError("cannot read from executor");
+      }
+      if (N == 0) {
+        if (IsEOF && Done == 0) {
+          *IsEOF = true;
+          return llvm::Error::success();
+        }
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "unexpected end of file");
+      }
+      Done += N;
+    }
+    return llvm::Error::success();
+  }
+
+  llvm::Error writeBytes(const char *Src, size_t Size) {
+    while (Size) {
+      ssize_t N = send(FD, Src, Size, MSG_NOSIGNAL);
+      if (N < 0) {
+        if (errno == EINTR)
+          continue;
+        return errnoError("cannot write to executor");
+      }
+      Src += N;
+      Size -= N;
+    }
+    return llvm::Error::success();
+  }
+
+  void listenLoop() {
+    using namespace llvm::support;
+    llvm::Error Err = llvm::Error::success();
+    while (true) {
+      char Header[HeaderSize];
+      bool IsEOF = false;
+      if (auto E = readBytes(Header, HeaderSize, &IsEOF)) {
+        Err = joinErrors(std::move(Err), std::move(E));
+        break;
+      }
+      if (IsEOF)
+        break;
+
+      uint64_t Size = endian::read64le(Header);
+      auto OpC = static_cast<Opcode>(endian::read64le(Header + 8));
+      uint64_t SeqNo = endian::read64le(Header + 16);
+      llvm::orc::ExecutorAddr TagAddr(endian::read64le(Header + 24));
+      if (Size < HeaderSize) {
+        Err = joinErrors(std::move(Err),
+                         llvm::createStringError(
+                             llvm::inconvertibleErrorCode(),
+                             "message size too small"));
+        break;
+      }
+
+      llvm::orc::SimpleRemoteEPCArgBytesVector ArgBytes;
+      ArgBytes.resize(Size - HeaderSize);
+      if (auto E = readBytes(ArgBytes.data(), ArgBytes.size())) {
+        Err = joinErrors(std::move(Err), std::move(E));
+        break;
+      }
+
+      auto Action = C.handleMessage(OpC, SeqNo, TagAddr, std::move(ArgBytes));
+      if (!Action) {
+        Err = joinErrors(std::move(Err), Action.takeError());
+        break;
+      }
+      if (*Action == llvm::orc::SimpleRemoteEPCTransportClient::EndSession)
+        break;
+    }
+    disconnect();
+    C.handleDisconnect(std::move(Err));
+  }
+
+public:
+  static llvm::Expected<std::unique_ptr<SocketEPCTransport>>
+  Create(llvm::orc::SimpleRemoteEPCTransportClient &C, int FD) {
+    return std::unique_ptr<SocketEPCTransport>(new SocketEPCTransport(C, FD));
+  }
+
+  ~SocketEPCTransport() override {
+    if (ListenerThread.joinable())
+      ListenerThread.join();
+    close(FD);
+  }
+
+  llvm::Error start() override {
+    ListenerThread = std::thread([this]() { listenLoop(); });
+    return llvm::Error::success();
+  }
+
+  llvm::Error sendMessage(Opcode OpC, uint64_t SeqNo,
+                          llvm::orc::ExecutorAddr TagAddr,
+                          llvm::ArrayRef<char> ArgBytes) override {
+    using namespace llvm::support;
+    char Header[HeaderSize];
+    endian::write64le(Header, HeaderSize + ArgBytes.size());
+    endian::write64le(Header + 8, static_cast<uint64_t>(OpC));
+    endian::write64le(Header + 16, SeqNo);
+    endian::write64le(Header + 24, TagAddr.getValue());
+
+    std::lock_guard<std::mutex> Lock(M);
+    if (Disconnected)
+      return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                     "executor disconnected");
+    if (auto Err = writeBytes(Header, HeaderSize))
+      return Err;
+    return writeBytes(ArgBytes.data(), ArgBytes.size());
+  }
+
+  // shuts the socket down rather than closing it, which wakes the listener
+  // without handing its descriptor to the next open. it is closed once the
+  // listener is joined.
+  void disconnect() override {
+    if (!Disconnected.exchange(true))
+      shutdown(FD, SHUT_RDWR);
+  }
+};
+
+} // anonymous namespace
+
+std::string getDefaultExecutorPath() {
+  std::string Exe = llvm::sys::fs::getMainExecutable(
+      nullptr, reinterpret_cast<void *>(&getDefaultExecutorPath));
+
+  llvm::SmallString<256> Path(llvm::sys::path::parent_path(Exe));
+  llvm::sys::path::append(Path, "llvm-jitlink-executor");
+  return std::string(Path.str());
+}
+
+llvm::Expected<std::unique_ptr<llvm::orc::ExecutorProcessControl>>
+launchExecutor(llvm::StringRef ExecutorPath, pid_t &PID) {
+  using namespace llvm::orc;
+
+  std::string Path = ExecutorPath.str();
+  if (!llvm::sys::fs::can_execute(Path)) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   "cannot execute %s", Path.c_str());
+  }
+
+  int Sockets[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, Sockets)) {
+    return errnoError("cannot create socket");
+  }
+
+  // the controller end is closed in the executor by exec, and does not leak
+  // into executors started later
+  fcntl(Sockets[0], F_SETFD, FD_CLOEXEC);
+
+  std::string FDs = "filedescs=" + std::to_string(Sockets[1]) + "," +
+                    std::to_string(Sockets[1]);
+  PID = fork();
+  if (PID == 0) {
+    const char *Argv[] = {Path.c_str(), FDs.c_str(), nullptr};
+    execv(Path.c_str(), const_cast<char *const *>(Argv));
+    _exit(127);
+  }
+
+  llvm::Error ForkErr = PID < 0 ? errnoError("cannot start executor")
+                                : llvm::Error::success();
+  close(Sockets[1]);
+  if (ForkErr) {
+    close(Sockets[0]);
+    return std::move(ForkErr);
+  }
+
+  auto EPC = SimpleRemoteEPC::Create<SocketEPCTransport>(
+      std::make_unique<DynamicThreadPoolTaskDispatcher>(),
+      SimpleRemoteEPC::Setup(), Sockets[0]);
+  if (!EPC) {
+    // the failed handshake disconnected, so the child is on its way out
+    waitpid(PID, nullptr, 0);
+    return EPC.takeError();
+  }
+  return std::move(*EPC);
+}
+
+llvm::Error reapExecutor(pid_t PID, llvm::Error Err) {
+  int Status = 0;
+  while (waitpid(PID, &Status, 0) < 0) {
+    if (errno != EINTR)
+      return Err;
+  }
+
+  if (WIFSIGNALED(Status)) {
+    llvm::consumeError(std::move(Err));
+    int Sig = WTERMSIG(Status);
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   "script terminated by signal %d (%s)", Sig,
+                                   strsignal(Sig));
+  }
+
+  // a script that calls exit() takes the executor down mid-call
+  if (Err && WIFEXITED(Status)) {
+    llvm::consumeError(std::move(Err));
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   "script exited with status %d",
+                                   WEXITSTATUS(Status));
+  }
+  return Err;
+}
+
+llvm::FunctionType *getExecutorEntryType(llvm::LLVMContext &Ctx) {
+  llvm::Type *IntTy = llvm::Type::getInt32Ty(Ctx);
+  return llvm::FunctionType::get(
+      IntTy, {IntTy, llvm::Type::getInt8PtrTy(Ctx)->getPointerTo()}, false);
+}
+
+std::unique_ptr<llvm::Module> createEntryWrapper(llvm::LLVMContext &Ctx,
+                                                 const llvm::DataLayout &DL,
+                                                 llvm::StringRef Name,
+                                                 llvm::StringRef Callee) {
+  auto M = std::make_unique<llvm::Module>("ccint-entry", Ctx);
+  M->setDataLayout(DL);
+
+  llvm::IRBuilder<> B(Ctx);
+  llvm::FunctionCallee Target = M->getOrInsertFunction(Callee, B.getVoidTy());
+  llvm::Function *F =
+      llvm::Function::Create(getExecutorEntryType(Ctx),
+                             llvm::GlobalValue::ExternalLinkage, Name, *M);
+  B.SetInsertPoint(llvm::BasicBlock::Create(Ctx, "entry", F));
+  B.CreateCall(Target);
+  B.CreateRet(B.getInt32(0));
+  return M;
+}
+
+namespace {
+
+// replaces the array Array of M, whose elements are Entries, with an entry
+// `int Name(int, char **)` that calls them in priority order. Reverse runs
+// them backwards: highest priority first, and the last one of a priority
+// first.
+bool scrapeFunctionArray(
+    llvm::Module &M, llvm::StringRef Array,
+    llvm::iterator_range<llvm::orc::CtorDtorIterator> Entries,
+    llvm::StringRef Name, bool Reverse) {
+  llvm::GlobalVariable *GV = M.getNamedGlobal(Array);
+  if (!GV)
+    return false;
+
+  std::vector<std::pair<unsigned, llvm::Function *>> Funcs;
+  for (auto Entry : Entries) {
+    if (Entry.Func)
+      Funcs.push_back({Entry.Priority, Entry.Func});
+  }
+  GV->eraseFromParent();
+  if (Funcs.empty())
+    return false;
+
+  std::stable_sort(Funcs.begin(), Funcs.end(),
+                   [](const std::pair<unsigned, llvm::Function *> &LHS,
+                      const std::pair<unsigned, llvm::Function *> &RHS) {
+                     return LHS.first < RHS.first;
+                   });
+  if (Reverse)
+    std::reverse(Funcs.begin(), Funcs.end());
+
+  llvm::IRBuilder<> B(M.getContext());
+  llvm::Function *F =
+      llvm::Function::Create(getExecutorEntryType(M.getContext()),
+                             llvm::GlobalValue::ExternalLinkage, Name, M);
+  B.SetInsertPoint(llvm::BasicBlock::Create(M.getContext(), "entry", F));
+  for (auto &Func : Funcs)
+    B.CreateCall(Func.second->getFunctionType(), Func.second);
+  B.CreateRet(B.getInt32(0));
+  return true;
+}
+
+} // anonymous namespace
+
+bool scrapeConstructors(llvm::Module &M, llvm::StringRef Name) {
+  return scrapeFunctionArray(M, "llvm.global_ctors",
+                             llvm::orc::getConstructors(M), Name,
+                             /*Reverse=*/false);
+}
+
+bool scrapeDestructors(llvm::Module &M, llvm::StringRef Name) {
+  return scrapeFunctionArray(M, "llvm.global_dtors",
+                             llvm::orc::getDestructors(M), Name,
+                             /*Reverse=*/true);
+}
+
+std::unique_ptr<llvm::Module>
+createExecutorRuntime(llvm::LLVMContext &Ctx, const llvm::DataLayout &DL,
+                      bool OpenMP) {
+  auto M = std::make_unique<llvm::Module>("ccint-executor-runtime", Ctx);
+  M->setDataLayout(DL);
+
+  llvm::IRBuilder<> B(Ctx);
+  llvm::Type *VoidTy = B.getVoidTy();
+  llvm::Type *IntTy = B.getInt32Ty();
+  llvm::PointerType *PtrTy = B.getInt8PtrTy();
+  llvm::Constant *Null = llvm::ConstantPointerNull::get(PtrTy);
+  auto External = llvm::GlobalValue::ExternalLinkage;
+
+  new llvm::GlobalVariable(*M, B.getInt8Ty(), false, External, B.getInt8(0),
+                           "__dso_handle");
+
+  // registered handlers form a list of {fn, arg, next}, newest first
+  llvm::StructType *NodeTy =
+      llvm::StructType::create(Ctx, {PtrTy, PtrTy, PtrTy}, "ccint.atexit");
+  llvm::PointerType *NodePtrTy = NodeTy->getPointerTo();
+  auto *Head = new llvm::GlobalVariable(
+      *M, PtrTy, false, llvm::GlobalValue::InternalLinkage, Null,
+      "ccint.atexit.head");
+
+  llvm::Type *SizeTy = DL.getIntPtrType(Ctx);
+  llvm::FunctionCallee Malloc =
+      M->getOrInsertFunction("malloc", PtrTy, SizeTy);
+  llvm::FunctionCallee Free = M->getOrInsertFunction("free", VoidTy, PtrTy);
+
+  // int __cxa_atexit(void (*fn)(void *), void *arg, void *dso)
+  llvm::Function *CxaAtExit = llvm::Function::Create(
+      llvm::FunctionType::get(IntTy, {PtrTy, PtrTy, PtrTy}, false), External,
+      "__cxa_atexit", *M);
+  {
+    auto *Entry = llvm::BasicBlock::Create(Ctx, "entry", CxaAtExit);
+    auto *Push = llvm::BasicBlock::Create(Ctx, "push", CxaAtExit);
+    auto *Fail = llvm::BasicBlock::Create(Ctx, "fail", CxaAtExit);
+    auto *Done = llvm::BasicBlock::Create(Ctx, "done", CxaAtExit);
+
+    B.SetInsertPoint(Entry);
+    llvm::Value *Node = B.CreateCall(
+        Malloc, {llvm::ConstantInt::get(SizeTy, DL.getTypeAllocSize(NodeTy))});
+    llvm::Value *NodePtr = B.CreateBitCast(Node, NodePtrTy);
+    B.CreateCondBr(B.CreateICmpEQ(Node, Null), Fail, Push);
+
+    B.SetInsertPoint(Fail);
+    B.CreateRet(B.getInt32(-1));
+
+    // handlers may be registered from several threads at once
+    B.SetInsertPoint(Push);
+    B.CreateStore(CxaAtExit->getArg(0), B.CreateStructGEP(NodeTy, NodePtr, 0));
+    B.CreateStore(CxaAtExit->getArg(1), B.CreateStructGEP(NodeTy, NodePtr, 1));
+    llvm::Value *NextPtr = B.CreateStructGEP(NodeTy, NodePtr, 2);
+    llvm::LoadInst *Old = B.CreateLoad(PtrTy, Head);
+    Old->setAtomic(llvm::AtomicOrdering::Monotonic);
+    B.CreateBr(Done);
+
+    B.SetInsertPoint(Done);
+    llvm::PHINode *Expected = B.CreatePHI(PtrTy, 2);
+    Expected->addIncoming(Old, Push);
+    B.CreateStore(Expected, NextPtr);
+    llvm::Value *Pair = B.CreateAtomicCmpXchg(
+        Head, Expected, Node, llvm::MaybeAlign(),
+        llvm::AtomicOrdering::Release, llvm::AtomicOrdering::Monotonic);
+    Expected->addIncoming(B.CreateExtractValue(Pair, 0), Done);
+    auto *Ret = llvm::BasicBlock::Create(Ctx, "ret", CxaAtExit);
+    B.CreateCondBr(B.CreateExtractValue(Pair, 1), Ret, Done);
+
+    B.SetInsertPoint(Ret);
+    B.CreateRet(B.getInt32(0));
+  }
+
+  // int atexit(void (*fn)(void))
+  llvm::Function *AtExit = llvm::Function::Create(
+      llvm::FunctionType::get(IntTy, {PtrTy}, false), External, "atexit",
+      *M);
+  B.SetInsertPoint(llvm::BasicBlock::Create(Ctx, "entry", AtExit));
+  B.CreateRet(B.CreateCall(CxaAtExit, {AtExit->getArg(0), Null, Null}));
+
+  // __ccint_run_dtors, called once jit'd code is done running. the handlers
+  // may register more handlers, which run as well.
+  llvm::Function *RunDtors = llvm::Function::Create(
+      getExecutorEntryType(Ctx), External, "__ccint_run_dtors", *M);
+  {
+    auto *Entry = llvm::BasicBlock::Create(Ctx, "entry", RunDtors);
+    auto *Loop = llvm::BasicBlock::Create(Ctx, "loop", RunDtors);
+    auto *Body = llvm::BasicBlock::Create(Ctx, "body", RunDtors);
+    auto *Exit = llvm::BasicBlock::Create(Ctx, "exit", RunDtors);
+
+    B.SetInsertPoint(Entry);
+    B.CreateBr(Loop);
+
+    B.SetInsertPoint(Loop);
+    llvm::Value *Node = B.CreateLoad(PtrTy, Head);
+    B.CreateCondBr(B.CreateICmpEQ(Node, Null), Exit, Body);
+
+    B.SetInsertPoint(Body);
+    llvm::Value *NodePtr = B.CreateBitCast(Node, NodePtrTy);
+    llvm::Value *Fn =
+        B.CreateLoad(PtrTy, B.CreateStructGEP(NodeTy, NodePtr, 0));
+    llvm::Value *Arg =
+        B.CreateLoad(PtrTy, B.CreateStructGEP(NodeTy, NodePtr, 1));
+    llvm::Value *Next =
+        B.CreateLoad(PtrTy, B.CreateStructGEP(NodeTy, NodePtr, 2));
+    B.CreateStore(Next, Head);
+    B.CreateCall(Free, {Node});
+    llvm::FunctionType *HandlerTy =
+        llvm::FunctionType::get(VoidTy, {PtrTy}, false);
+    B.CreateCall(HandlerTy, B.CreateBitCast(Fn, HandlerTy->getPointerTo()),
+                 {Arg});
+    B.CreateBr(Loop);
+
+    B.SetInsertPoint(Exit);
+    B.CreateRet(B.getInt32(0));
+  }
+
+  // __ccint_finish, what exit does after the handlers. the executor stays
+  // up across scripts, so stdio is flushed here. libomp is hard-paused, it
+  // would touch the threadprivate caches of jit'd code on its own exit.
+  llvm::Function *Finish = llvm::Function::Create(
+      getExecutorEntryType(Ctx), External, "__ccint_finish", *M);
+  B.SetInsertPoint(llvm::BasicBlock::Create(Ctx, "entry", Finish));
+  B.CreateCall(M->getOrInsertFunction("fflush", IntTy, PtrTy), {Null});
+  if (OpenMP) {
+    // the executor runs every call on a thread of its own. libomp ignores a
+    // pause from a thread it has not seen, so the thread introduces itself
+    // first.
+    B.CreateCall(M->getOrInsertFunction("omp_get_max_threads", IntTy));
+    B.CreateCall(M->getOrInsertFunction("omp_pause_resource_all", IntTy,
+                                        IntTy),
+                 {B.getInt32(/*omp_pause_hard=*/2)});
+  }
+  B.CreateRet(B.getInt32(0));
+
+  return M;
+}
+
+} // namespace clang
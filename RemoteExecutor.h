@@ -0,0 +1,69 @@
+#ifndef LLVM_CLANG_TOOLS_CLANG_CCINT_REMOTE_EXECUTOR_H
+#define LLVM_CLANG_TOOLS_CLANG_CCINT_REMOTE_EXECUTOR_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+
+#include <memory>
+#include <string>
+
+#include <sys/types.h>
+
+namespace llvm {
+class DataLayout;
+class FunctionType;
+class LLVMContext;
+class Module;
+namespace orc {
+class ExecutorProcessControl;
+} // namespace orc
+} // namespace llvm
+
+namespace clang {
+
+// llvm-jitlink-executor next to the ccint executable.
+std::string getDefaultExecutorPath();
+
+// starts ExecutorPath as a child process connected through a socket pair
+// and returns the controller side. PID receives the pid of the child.
+llvm::Expected<std::unique_ptr<llvm::orc::ExecutorProcessControl>>
+launchExecutor(llvm::StringRef ExecutorPath, pid_t &PID);
+
+// waits for the executor, which must have been disconnected, and returns
+// Err, or a description of how the executor died if it did not exit
+// cleanly.
+llvm::Error reapExecutor(pid_t PID, llvm::Error Err);
+
+// the executor calls into jit'd code through
+// ExecutorProcessControl::runAsMain, so every function it runs has the type
+// int(int, char **).
+llvm::FunctionType *getExecutorEntryType(llvm::LLVMContext &Ctx);
+
+// a module defining `int Name(int, char **)`, which calls `void Callee()`
+// and returns 0.
+std::unique_ptr<llvm::Module> createEntryWrapper(llvm::LLVMContext &Ctx,
+                                                 const llvm::DataLayout &DL,
+                                                 llvm::StringRef Name,
+                                                 llvm::StringRef Callee);
+
+// replaces llvm.global_ctors of M with an entry `int Name(int, char **)`
+// that calls the constructors in priority order. returns false if there
+// are none.
+bool scrapeConstructors(llvm::Module &M, llvm::StringRef Name);
+
+// likewise for llvm.global_dtors, in the reverse order.
+bool scrapeDestructors(llvm::Module &M, llvm::StringRef Name);
+
+// jit'd definitions of __dso_handle, __cxa_atexit and atexit, plus an entry
+// `int __ccint_run_dtors(int, char **)` which runs the registered handlers.
+// the executor unmaps jit'd code when it is disconnected, so exit handlers
+// must not end up in its libc. the entry `int __ccint_finish(int, char **)`
+// does the rest of what exit does for a script: it flushes stdio and, with
+// OpenMP, hard-pauses libomp.
+std::unique_ptr<llvm::Module>
+createExecutorRuntime(llvm::LLVMContext &Ctx, const llvm::DataLayout &DL,
+                      bool OpenMP);
+
+} // namespace clang
+
+#endif // LLVM_CLANG_TOOLS_CLANG_CCINT_REMOTE_EXECUTOR_H
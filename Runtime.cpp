@@ -0,0 +1,261 @@
+#include "Runtime.h"
+#include "include/ccint.h"
+
+#include "clang/Config/config.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Errc.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace clang {
+
+namespace {
+
+void applyHints(void *Base, size_t Length, int Flags) {
+  if (Flags & CCINT_MAP_SEQUENTIAL)
+    madvise(Base, Length, MADV_SEQUENTIAL);
+  if (Flags & CCINT_MAP_RANDOM)
+    madvise(Base, Length, MADV_RANDOM);
+  if (Flags & CCINT_MAP_WILLNEED)
+    madvise(Base, Length, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+  // only honored for file mappings on filesystems that support it
+  if (Flags & CCINT_MAP_HUGEPAGE)
+    madvise(Base, Length, MADV_HUGEPAGE);
+#endif
+}
+
+// maps FD from its current offset to the end of the file.
+int mapFile(int FD, int Flags, ccint_buffer *Out) {
+  struct stat St;
+  if (fstat(FD, &St))
+    return errno;
+
+  off_t Pos = lseek(FD, 0, SEEK_CUR);
+  if (Pos < 0)
+    Pos = 0;
+  if (St.st_size <= Pos) {
+    *Out = {"", 0, nullptr, 0};
+    return 0;
+  }
+
+  off_t PageSize = sysconf(_SC_PAGESIZE);
+  off_t Start = Pos - Pos % PageSize;
+  size_t Length = St.st_size - Start;
+
+  int MapFlags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+  if (Flags & CCINT_MAP_POPULATE)
+    MapFlags |= MAP_POPULATE;
+#endif
+
+  void *Base = mmap(nullptr, Length, PROT_READ, MapFlags, FD, Start);
+  if (Base == MAP_FAILED)
+    return errno;
+  applyHints(Base, Length, Flags);
+
+  Out->data = static_cast<const char *>(Base) + (Pos - Start);
+  Out->size = St.st_size - Pos;
+  Out->base_ = Base;
+  Out->length_ = Length;
+  return 0;
+}
+
+// pipes and terminals cannot be mapped, so they are read into anonymous
+// memory that grows by doubling.
+int readStream(int FD, int Flags, ccint_buffer *Out) {
+  size_t Capacity = 1 << 20;
+  size_t Size = 0;
+  void *Base = mmap(nullptr, Capacity, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (Base == MAP_FAILED)
+    return errno;
+
+  while (true) {
+    if (Size == Capacity) {
+      void *NewBase = mmap(nullptr, Capacity * 2, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (NewBase == MAP_FAILED) {
+        int Err = errno;
+        munmap(Base, Capacity);
+        return Err;
+      }
+      memcpy(NewBase, Base, Size);
+      munmap(Base, Capacity);
+      Base = NewBase;
+      Capacity *= 2;
+    }
+
+    ssize_t N = read(FD, static_cast<char *>(Base) + Size, Capacity - Size);
+    if (N < 0) {
+      if (errno == EINTR)
+        continue;
+      int Err = errno;
+      munmap(Base, Capacity);
+      return Err;
+    }
+    if (N == 0)
+      break;
+    Size += N;
+  }
+
+  mprotect(Base, Capacity, PROT_READ);
+  applyHints(Base, Capacity, Flags & CCINT_MAP_HUGEPAGE);
+
+  Out->data = static_cast<const char *>(Base);
+  Out->size = Size;
+  Out->base_ = Base;
+  Out->length_ = Capacity;
+  return 0;
+}
+
+int mapInput(InputBuffers *Inputs, const char *Name, int Flags,
+             ccint_buffer *Out) {
+  if (!Name || !Out)
+    return EINVAL;
+
+  llvm::StringRef Data;
+  if (Inputs && Inputs->lookup(Name, Data)) {
+    *Out = {Data.data(), Data.size(), nullptr, 0};
+    return 0;
+  }
+
+  if (strcmp(Name, "-") == 0) {
+    struct stat St;
+    if (fstat(STDIN_FILENO, &St))
+      return errno;
+    if (S_ISREG(St.st_mode))
+      return mapFile(STDIN_FILENO, Flags, Out);
+    return readStream(STDIN_FILENO, Flags, Out);
+  }
+
+  int FD = open(Name, O_RDONLY | O_CLOEXEC);
+  if (FD < 0)
+    return errno;
+  int Err = mapFile(FD, Flags, Out);
+  close(FD);
+  return Err;
+}
+
+void unmapInput(ccint_buffer *Buf) {
+  if (!Buf)
+    return;
+  if (Buf->base_)
+    munmap(Buf->base_, Buf->length_);
+  *Buf = {nullptr, 0, nullptr, 0};
+}
+
+// ccint_map_input is a plain c function and cannot tell which interpreter
+// it was resolved for. every buffer table takes one of a fixed set of
+// entry points instead, each reading the table from its own slot. tables
+// beyond NumSlots get files and stdin only, and refuse buffers.
+using MapFunction = int (*)(const char *, int, ccint_buffer *);
+constexpr unsigned NumSlots = 64;
+std::atomic<InputBuffers *> Slots[NumSlots];
+
+int mapFileInput(const char *Name, int Flags, ccint_buffer *Out) {
+  return mapInput(nullptr, Name, Flags, Out);
+}
+
+template <unsigned I>
+int mapSlotInput(const char *Name, int Flags, ccint_buffer *Out) {
+  return mapInput(Slots[I].load(std::memory_order_acquire), Name, Flags, Out);
+}
+
+template <unsigned... Is>
+std::array<MapFunction, NumSlots>
+getSlotFunctions(std::integer_sequence<unsigned, Is...>) {
+  return {{&mapSlotInput<Is>...}};
+}
+
+const std::array<MapFunction, NumSlots> SlotFunctions =
+    getSlotFunctions(std::make_integer_sequence<unsigned, NumSlots>());
+
+} // anonymous namespace
+
+InputBuffers::InputBuffers() {
+  for (unsigned I = 0; I < NumSlots; I++) {
+    InputBuffers *Free = nullptr;
+    if (Slots[I].compare_exchange_strong(Free, this)) {
+      Slot = I;
+      return;
+    }
+  }
+}
+
+InputBuffers::~InputBuffers() {
+  if (Slot >= 0)
+    Slots[Slot].store(nullptr, std::memory_order_release);
+}
+
+llvm::Error InputBuffers::add(llvm::StringRef Name, llvm::StringRef Data) {
+  // scripts would never see the buffer
+  if (Slot < 0) {
+    return llvm::createStringError(
+        llvm::errc::resource_unavailable_try_again,
+        "cannot add input buffer %s: more than %u interpreters with input "
+        "buffers are alive",
+        Name.str().c_str(), NumSlots);
+  }
+
+  std::lock_guard<std::mutex> Guard(Lock);
+  Buffers[Name] = Data;
+  return llvm::Error::success();
+}
+
+bool InputBuffers::remove(llvm::StringRef Name) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  return Buffers.erase(Name);
+}
+
+bool InputBuffers::lookup(llvm::StringRef Name, llvm::StringRef &Data) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  auto It = Buffers.find(Name);
+  if (It == Buffers.end())
+    return false;
+  Data = It->second;
+  return true;
+}
+
+void *InputBuffers::getMapFunction() const {
+  if (Slot < 0)
+    return reinterpret_cast<void *>(&mapFileInput);
+  return reinterpret_cast<void *>(SlotFunctions[Slot]);
+}
+
+void getRuntimeSymbols(llvm::StringMap<void *> &Symbols,
+                       const InputBuffers *Inputs) {
+  Symbols["ccint_map_input"] = Inputs ? Inputs->getMapFunction()
+                                      : reinterpret_cast<void *>(&mapFileInput);
+  Symbols["ccint_unmap_input"] = reinterpret_cast<void *>(&unmapInput);
+}
+
+std::string getLibraryDir() {
+  std::string Exe = llvm::sys::fs::getMainExecutable(
+      nullptr, reinterpret_cast<void *>(&getLibraryDir));
+
+  // <prefix>/bin/clang-ccint -> <prefix>/lib
+  llvm::SmallString<256> Path(
+      llvm::sys::path::parent_path(llvm::sys::path::parent_path(Exe)));
+  llvm::sys::path::append(Path, CLANG_INSTALL_LIBDIR_BASENAME);
+  return std::string(Path.str());
+}
+
+std::string getRuntimeIncludePath() {
+  llvm::SmallString<256> Path(getLibraryDir());
+  llvm::sys::path::append(Path, "ccint", "include");
+  return std::string(Path.str());
+}
+
+} // namespace clang
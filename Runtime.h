@@ -0,0 +1,55 @@
+#ifndef LLVM_CLANG_TOOLS_CLANG_CCINT_RUNTIME_H
+#define LLVM_CLANG_TOOLS_CLANG_CCINT_RUNTIME_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+
+#include <mutex>
+#include <string>
+
+namespace clang {
+
+// named buffers that the scripts of one interpreter get through
+// ccint_map_input. the memory is handed out as is, without copying.
+class InputBuffers {
+  std::mutex Lock;
+  llvm::StringMap<llvm::StringRef> Buffers;
+  int Slot = -1;
+
+public:
+  InputBuffers();
+  ~InputBuffers();
+  InputBuffers(const InputBuffers &) = delete;
+  InputBuffers &operator=(const InputBuffers &) = delete;
+
+  // Data must stay alive until Name is removed or the table is gone. fails
+  // when the table got no slot, see getMapFunction.
+  llvm::Error add(llvm::StringRef Name, llvm::StringRef Data);
+
+  // returns false if Name was not registered.
+  bool remove(llvm::StringRef Name);
+
+  bool lookup(llvm::StringRef Name, llvm::StringRef &Data);
+
+  // the ccint_map_input that scripts see these buffers through. only a
+  // fixed number of tables can be alive at once, the others get one that
+  // maps files and stdin only.
+  void *getMapFunction() const;
+};
+
+// fills Symbols with the unmangled names and addresses of the functions
+// declared in ccint.h. without Inputs, ccint_map_input only maps files and
+// stdin. they exist in this process only.
+void getRuntimeSymbols(llvm::StringMap<void *> &Symbols,
+                       const InputBuffers *Inputs);
+
+// library directory of the llvm installation ccint runs from.
+std::string getLibraryDir();
+
+// directory holding ccint.h, relative to the ccint executable.
+std::string getRuntimeIncludePath();
+
+} // namespace clang
+
+#endif // LLVM_CLANG_TOOLS_CLANG_CCINT_RUNTIME_H
@@ -42,7 +42,7 @@ size_t getFileOffset(const clang::Token &Tok) {
   return Tok.getLocation().getRawEncoding();
 }
 
-size_t getWrapPos(const clang::LangOptions &LangOpts, const std::string &Code) {
+size_t getWrapPos(const clang::LangOptions &LangOpts, llvm::StringRef Code) {
 
   PPLexer Lex(LangOpts, Code);
   Token token;
@@ -56,7 +56,7 @@ size_t getWrapPos(const clang::LangOptions &LangOpts, const std::string &Code) {
     }
 
     if (token.is(tok::eof)) {
-      return std::string::npos;
+      return llvm::StringRef::npos;
     }
 
     const tok::TokenKind kind = token.getKind();
@@ -65,7 +65,7 @@ size_t getWrapPos(const clang::LangOptions &LangOpts, const std::string &Code) {
       StringRef keyword(token.getRawIdentifier());
       if (keyword.equals("using")) {
         if (Lex.AdvanceTo(token, tok::semi)) {
-          return std::string::npos;
+          return llvm::StringRef::npos;
         }
         return getFileOffset(token) + 1;
       }
@@ -74,7 +74,7 @@ size_t getWrapPos(const clang::LangOptions &LangOpts, const std::string &Code) {
     return getFileOffset(token);
   }
 
-  return std::string::npos;
+  return llvm::StringRef::npos;
 }
 
 bool isCCIntMain(clang::FunctionDecl *FD) {
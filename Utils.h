@@ -9,7 +9,10 @@ namespace clang {
 class LangOptions;
 class FunctionDecl;
 
-size_t getWrapPos(const clang::LangOptions &LangOpts, const std::string &Code);
+// offset of the first token that is not part of a preprocessor directive or
+// a leading using declaration, npos if there is none. only that prefix is
+// lexed.
+size_t getWrapPos(const clang::LangOptions &LangOpts, llvm::StringRef Code);
 bool isCCIntMain(clang::FunctionDecl *FD);
 
 bool isDynamicLibrary(llvm::StringRef Path);
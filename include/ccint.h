@@ -0,0 +1,95 @@
+/* ccint runtime interface, available to every script as <ccint.h> */
+#ifndef CCINT_H
+#define CCINT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* hints for ccint_map_input, may be or'ed together */
+enum {
+  CCINT_MAP_SEQUENTIAL = 1, /* read front to back, read ahead aggressively */
+  CCINT_MAP_RANDOM = 2,     /* random access, no read ahead */
+  CCINT_MAP_WILLNEED = 4,   /* start reading the whole input now */
+  CCINT_MAP_POPULATE = 8,   /* prefault all pages before returning */
+  CCINT_MAP_HUGEPAGE = 16,  /* back the mapping with huge pages if possible */
+};
+
+/* a read-only view of an input. data stays valid until ccint_unmap_input. */
+typedef struct ccint_buffer {
+  const char *data;
+  size_t size;
+
+  /* private, used by ccint_unmap_input */
+  void *base_;
+  size_t length_;
+} ccint_buffer;
+
+/* maps the input called name. names registered by the embedding host are
+ * returned as is, without copying. "-" is stdin: mapped directly when it is
+ * a regular file, read into anonymous memory otherwise. any other name is
+ * a file path. returns 0 on success or an errno value. */
+int ccint_map_input(const char *name, int flags, ccint_buffer *out);
+
+/* releases a view returned by ccint_map_input. */
+void ccint_unmap_input(ccint_buffer *buf);
+
+#ifdef __cplusplus
+} /* extern "C" */
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+namespace ccint {
+
+/* move-only owner of a ccint_buffer */
+class input {
+  ccint_buffer Buf = {};
+  int Err = 0;
+
+public:
+  input() = default;
+  explicit input(const char *name, int flags = 0) {
+    Err = ccint_map_input(name, flags, &Buf);
+  }
+  input(const input &) = delete;
+  input &operator=(const input &) = delete;
+  input(input &&Other) noexcept : Buf(Other.Buf), Err(Other.Err) {
+    Other.Buf = ccint_buffer();
+  }
+  input &operator=(input &&Other) noexcept {
+    if (this != &Other) {
+      ccint_unmap_input(&Buf);
+      Buf = Other.Buf;
+      Err = Other.Err;
+      Other.Buf = ccint_buffer();
+    }
+    return *this;
+  }
+  ~input() { ccint_unmap_input(&Buf); }
+
+  explicit operator bool() const { return Err == 0; }
+  int error() const { return Err; }
+
+  const char *data() const { return Buf.data; }
+  size_t size() const { return Buf.size; }
+  const char *begin() const { return Buf.data; }
+  const char *end() const { return Buf.data + Buf.size; }
+#if __cplusplus >= 201703L
+  std::string_view view() const { return std::string_view(Buf.data, Buf.size); }
+#endif
+};
+
+inline input map_input(const char *name, int flags = 0) {
+  return input(name, flags);
+}
+
+inline input map_stdin(int flags = 0) { return input("-", flags); }
+
+} // namespace ccint
+#endif
+
+#endif /* CCINT_H */